@@ -25,4 +25,25 @@ int loader_set_fw_good(void);
  */
 int loader_get_info(bootloader_info_t *info);
 
+/**
+ * Updates a running CRC32 (starting at 0) with n bytes from the buffer, using
+ * the loader's implementation. Returns kErrUnimplemented, leaving the CRC
+ * alone, if the loader is older than version 0x0020.
+ */
+int loader_crc32(uint32_t *crc, const void *buf, size_t nBytes);
+
+/**
+ * Makes the next boot go through the SPI flash. Call this before writing a new
+ * image to the current firmware's slot, or changing the boot state. Returns
+ * kErrUnimplemented if the loader is older than version 0x0020.
+ */
+int loader_invalidate_fast_boot(void);
+
+/**
+ * Resets the device, and has the loader check the SPI flash for an update
+ * rather than booting the installed firmware directly. This only returns, with
+ * kErrUnimplemented, if the loader is older than version 0x0020.
+ */
+int loader_request_update(void);
+
 #endif /* LOADER_HELPERS_H_ */
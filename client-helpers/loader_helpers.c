@@ -6,10 +6,21 @@
  */
 #include "loader_helpers.h"
 
+#include "errors.h"
+
 #include <string.h>
 
 /// interface to the bootloader, in flash
 static const bootloader_interface_t *kLoaderInfo = (bootloader_interface_t *) 0x08000fc0;
+/// first loader version that provides more than mark_fw_good and read_loader_info
+#define LOADER_VERSION_EXTENDED	0x0020
+
+/// handoff area shared with the bootloader, at the top of RAM
+static volatile bootloader_handoff_t * const kHandoff = (volatile bootloader_handoff_t *) BOOTLOADER_HANDOFF_ADDRESS;
+
+/// application interrupt and reset control register, and its reset request
+#define SCB_AIRCR				(*((volatile uint32_t *) 0xE000ED0C))
+#define SCB_AIRCR_RESET			((0x05FA << 16) | (1 << 2))
 
 /// callbacks to use for all calls
 static bootloader_flash_callbacks_t gCallbacks;
@@ -36,3 +47,44 @@ int loader_set_fw_good(void) {
 int loader_get_info(bootloader_info_t *info) {
 	return kLoaderInfo->read_loader_info(&gCallbacks, info);
 }
+
+/**
+ * Updates a running CRC32 with n bytes from the buffer.
+ */
+int loader_crc32(uint32_t *crc, const void *buf, size_t nBytes) {
+	if(kLoaderInfo->version < LOADER_VERSION_EXTENDED) {
+		return kErrUnimplemented;
+	}
+
+	*crc = kLoaderInfo->crc32_update(*crc, buf, nBytes);
+	return kErrSuccess;
+}
+
+/**
+ * Makes the next boot go through the SPI flash.
+ */
+int loader_invalidate_fast_boot(void) {
+	if(kLoaderInfo->version < LOADER_VERSION_EXTENDED) {
+		return kErrUnimplemented;
+	}
+
+	return kLoaderInfo->invalidate_fast_boot();
+}
+
+/**
+ * Resets the device, and has the loader check the SPI flash for an update.
+ */
+int loader_request_update(void) {
+	if(kLoaderInfo->version < LOADER_VERSION_EXTENDED) {
+		return kErrUnimplemented;
+	}
+
+	kHandoff->request = BOOTLOADER_UPDATE_MAGIC;
+
+	// make sure the request is written before the reset
+	asm volatile("dsb" : : : "memory");
+	SCB_AIRCR = SCB_AIRCR_RESET;
+	asm volatile("dsb" : : : "memory");
+
+	while(1) {}
+}
@@ -4,7 +4,8 @@
  * Provides an interface to the basic bootloader on the Lichtenstein devices.
  *
  * The loader occupies the first 0x1000 bytes of flash. A structure describing
- * the loader's API is located in the last 0x40 bytes.
+ * the loader's API is located in the last 0x40 bytes. The last 0x800 bytes of
+ * flash hold the loader's boot state, so it can boot without the SPI flash.
  *
  *  Created on: Nov 6, 2018
  *      Author: tristan
@@ -16,6 +17,36 @@
 #include <stdint.h>
 #include <stddef.h>
 
+/// Address of the application in internal flash
+#define BOOTLOADER_APP_ADDRESS		0x08001000
+/// Size of the application region in internal flash, including the version
+#define BOOTLOADER_APP_SIZE			0x6800
+/// Address of the application's version block in internal flash
+#define BOOTLOADER_VERSION_ADDRESS	0x080077F0
+/// Address and size of the loader's boot state in internal flash
+#define BOOTLOADER_BOOTSTATE_ADDRESS	0x08007800
+#define BOOTLOADER_BOOTSTATE_SIZE	0x800
+
+/// Address of the handoff area, in the last 128 bytes of RAM (6K on the
+/// STM32F042, 16K on the STM32F072); applications must not place anything
+/// there (not even their stack)
+#if defined(STM32F042)
+#define BOOTLOADER_HANDOFF_ADDRESS	0x20001780
+#elif defined(STM32F072)
+#define BOOTLOADER_HANDOFF_ADDRESS	0x20003F80
+#endif
+
+/// Address of the loader info block in the SPI flash
+#define BOOTLOADER_INFO_ADDRESS		0x000000
+/// Address of the boot state journal in the SPI flash: two sectors follow
+#define BOOTLOADER_JOURNAL_ADDRESS	0x001000
+/// Size of each of the journal's sectors
+#define BOOTLOADER_JOURNAL_SECTOR_SIZE	0x1000
+/// Size of a firmware slot in the SPI flash
+#define BOOTLOADER_SLOT_SIZE		0x8000
+/// Address of the given firmware slot (0-7) in the SPI flash
+#define BOOTLOADER_SLOT_ADDRESS(n)	(0x008000 + ((n) * BOOTLOADER_SLOT_SIZE))
+
 /**
  * Callbacks used by the bootloader to access the flash
  */
@@ -31,15 +62,33 @@ typedef struct {
 	int (*flash_erase)(uint32_t, size_t);
 	/// Writes to the flash. Requires the page is erased first.
 	int (*flash_write)(uint32_t, size_t, void *);
+
+	/// Reads from the security registers. These are only used by the loader
+	/// itself, to count start failures; applications may leave them NULL.
+	int (*flash_read_security)(uint32_t, size_t, void *);
+	/// Erases the security register containing the address.
+	int (*flash_erase_security)(uint32_t);
+	/// Writes to a security register. Requires the register is erased first.
+	int (*flash_write_security)(uint32_t, size_t, void *);
 } bootloader_flash_callbacks_t;
 
 
 
+/// Header word of a version 2 info block: 'LI', then the version
+#define BOOTLOADER_INFO_HEADER		0x0002494C
+
 /**
  * A bootloader info struct, containing information about each of the firmwares
  * stored in the flash.
+ *
+ * This is version 2 of the layout: all fields are naturally aligned, so they
+ * can be accessed with plain loads and stores. The loader also reads info
+ * blocks in the version 1 layout (bootloader_info_v1_t.)
  */
 typedef struct {
+	/// Must be BOOTLOADER_INFO_HEADER
+	uint32_t header;
+
 	/// Total number of firmware images in flash.
 	uint8_t totalFirmwares;
 
@@ -47,6 +96,8 @@ typedef struct {
 	uint8_t currentFirmware;
 	/// Which firmware is the failsafe firmware?
 	uint8_t failsafeFirmware;
+	/// Reserved; must be 0xFF
+	uint8_t reserved;
 
 	/// Info about one of 8 firmware images
 	struct {
@@ -56,11 +107,176 @@ typedef struct {
 		uint8_t startFails;
 		/// How many startup successes were there?
 		uint8_t startSuccesses;
+
+		/// Reserved; must be 0xFF
+		uint32_t reserved;
 	} fwInfo[8];
 
 	// CRC32 of the structure
 	uint32_t crc32;
-} __attribute__((__packed__)) bootloader_info_t;
+} bootloader_info_t;
+
+/**
+ * Version 1 of the info block layout, which has no header.
+ */
+typedef struct {
+	/// Total number of firmware images in flash.
+	uint8_t totalFirmwares;
+
+	/// Which firmware is currently running?
+	uint8_t currentFirmware;
+	/// Which firmware is the failsafe firmware?
+	uint8_t failsafeFirmware;
+
+	/// Info about one of 8 firmware images
+	struct {
+		/// Firmware version (0xFFFF == unused)
+		uint16_t version;
+		/// How many startup failures were there?
+		uint8_t startFails;
+		/// How many startup successes were there?
+		uint8_t startSuccesses;
+	} __attribute__((__packed__)) fwInfo[8];
+
+	// CRC32 of the structure
+	uint32_t crc32;
+} __attribute__((__packed__)) bootloader_info_v1_t;
+
+/**
+ * Version block, located in the last 16 bytes of the application region. This
+ * is provided by the application, except for the CRC, which is written by the
+ * loader once the image has been installed.
+ */
+typedef struct {
+	/// Firmware version, in the same format as in the info block
+	uint16_t version;
+	/// Reserved; must be 0xFF
+	uint8_t reserved[10];
+
+	/// CRC32 of the installed image (from its header); must be 0xFF in images
+	uint32_t crc32;
+} bootloader_version_t;
+
+_Static_assert(sizeof(bootloader_version_t) == 16, "version block layout changed");
+
+
+
+/// Magic value of an update request in the handoff area ('UPDT')
+#define BOOTLOADER_UPDATE_MAGIC		0x54445055
+
+/**
+ * Handoff area, which is left alone by the loader's startup code and survives
+ * resets (but not power cycles.) An application requests an update by setting
+ * the request field, then resetting; the loader then boots through the SPI
+ * flash even if it could boot the installed firmware directly.
+ *
+ * The rest of the area holds the loader's snapshot of the boot state, which
+ * read_loader_info and mark_fw_good work from. The loader only stores it when
+ * it boots through the SPI flash: after a power cycle followed by a direct
+ * boot, there is no snapshot, so the first read_loader_info call reads the
+ * journal through the flash callbacks (and stores the snapshot for later
+ * calls.) mark_fw_good does nothing after a direct boot, since the firmware is
+ * already recorded as good.
+ */
+typedef struct {
+	/// BOOTLOADER_UPDATE_MAGIC if an update was requested
+	uint32_t request;
+	/// Reserved for the loader
+	uint32_t reserved[31];
+} bootloader_handoff_t;
+
+_Static_assert(sizeof(bootloader_handoff_t) == 128, "handoff area layout changed");
+
+
+
+/// Magic value of a firmware image header ('LFWI')
+#define BOOTLOADER_IMAGE_MAGIC		0x4957464C
+/// Current version of the firmware image header
+#define BOOTLOADER_IMAGE_HEADER_VERSION	1
+
+/// Image type: the image data is copied as is
+#define BOOTLOADER_IMAGE_TYPE_RAW	0x00
+/// Image type: the image data is a delta against the installed image
+#define BOOTLOADER_IMAGE_TYPE_DELTA	0x01
+/// Image type: the image data is LZ compressed
+#define BOOTLOADER_IMAGE_TYPE_LZ	0x02
+
+/**
+ * Header at the start of each firmware slot in the SPI flash. The image data
+ * follows immediately after it.
+ *
+ * Images never include trailing 0xFF bytes: the rest of the application region
+ * is erased when they're installed.
+ */
+typedef struct {
+	/// Must be BOOTLOADER_IMAGE_MAGIC
+	uint32_t magic;
+	/// Must be BOOTLOADER_IMAGE_HEADER_VERSION
+	uint8_t headerVersion;
+	/// Type of image data (BOOTLOADER_IMAGE_TYPE_*)
+	uint8_t type;
+	/// Flags; none are defined yet, so this must be 0
+	uint16_t flags;
+
+	/// Length of the image data following the header, in bytes
+	uint32_t length;
+	/// CRC32 of the installed image; this identifies the image
+	uint32_t crc32;
+
+	/// Firmware version, in the same format as in the info block
+	uint16_t version;
+	/// Reserved; must be 0xFFFF
+	uint16_t reserved;
+} bootloader_image_header_t;
+
+_Static_assert(sizeof(bootloader_image_header_t) == 20, "image header layout changed");
+
+/**
+ * The data of a delta image starts with this header. It is followed by one
+ * record for each block of the output: the CRC32 of the output block, then the
+ * ops that produce it. Ops never cross a block boundary.
+ *
+ * Each op starts with a 16-bit word. If BOOTLOADER_DELTA_COPY is set, the low
+ * bits are a length, and the next 16-bit word is the offset in the installed
+ * image to copy that many bytes from; the offset must not be before the start
+ * of the block being produced, as that part has already been overwritten, and
+ * the bytes mustn't include the CRC in the version block.
+ * Otherwise, the word is the number of literal bytes that follow.
+ */
+typedef struct {
+	/// CRC32 of the image the delta applies to
+	uint32_t baseCrc;
+	/// Length of the output image, in bytes
+	uint32_t length;
+} bootloader_delta_header_t;
+
+_Static_assert(sizeof(bootloader_delta_header_t) == 8, "delta header layout changed");
+
+/// Size of a block of delta output
+#define BOOTLOADER_DELTA_BLOCK_SIZE	0x400
+/// Flag in an op word indicating a copy from the installed image
+#define BOOTLOADER_DELTA_COPY		0x8000
+
+/**
+ * The data of a compressed image starts with this header, followed by the
+ * compressed data: groups of a flag byte, then eight items, one for each bit of
+ * the flag byte starting at the LSB. If the bit is set, the item is a literal
+ * byte. Otherwise, it's a 16-bit little endian reference to earlier output:
+ * the low 12 bits are the distance back minus one, the high 4 bits the length
+ * minus BOOTLOADER_LZ_MIN_MATCH. Decoding stops once the output is complete.
+ */
+typedef struct {
+	/// Length of the output image, in bytes
+	uint32_t length;
+} bootloader_lz_header_t;
+
+_Static_assert(sizeof(bootloader_lz_header_t) == 4, "compressed image header layout changed");
+
+/// How far back a reference may reach
+#define BOOTLOADER_LZ_WINDOW		0x1000
+/// Shortest and longest reference
+#define BOOTLOADER_LZ_MIN_MATCH		3
+#define BOOTLOADER_LZ_MAX_MATCH		(BOOTLOADER_LZ_MIN_MATCH + 15)
 
 /**
  * Functions and information provided by the bootloader in ROM.
@@ -69,10 +285,24 @@ typedef struct {
 	/// Version of the loader
 	uint32_t version;
 
-	/// Marks this firmware as "good."
+	/// Marks this firmware as "good." This does nothing if the firmware was
+	/// booted directly, as it's already good; otherwise, the first call after a
+	/// power cycle may read the journal through the callbacks. See
+	/// bootloader_handoff_t. (Version 0x0012+)
 	int (*mark_fw_good)(bootloader_flash_callbacks_t *);
-	/// Reads out the loader information block from flash.
+	/// Reads out the boot state; this is the info block with the journal
+	/// applied, in the version 2 layout. Returns the generation of the state,
+	/// which changes whenever it does. The first call after a power cycle may
+	/// read the journal through the callbacks. (Version 0x0020+)
 	int (*read_loader_info)(bootloader_flash_callbacks_t *, bootloader_info_t *);
-} __attribute__((__packed__)) bootloader_interface_t;
+
+	/// Updates a running CRC32 (starting at 0) with a buffer. (Version 0x0011+)
+	uint32_t (*crc32_update)(uint32_t, const void *, size_t);
+
+	/// Makes the next boot go through the SPI flash, rather than booting the
+	/// installed firmware directly; call this before changing the boot state
+	/// or the current firmware's slot. (Version 0x0012+)
+	int (*invalidate_fast_boot)(void);
+} bootloader_interface_t;
 
 #endif /* LOADER_H_ */
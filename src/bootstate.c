@@ -0,0 +1,212 @@
+/*
+ * bootstate.c
+ *
+ * The boot state area is a log of 8-byte records. New records are written
+ * after the last one, and the previous record is then invalidated by
+ * programming its marker to 0; once the area is full, it's erased and writing
+ * starts over at its start. The area is thus only erased once every 256 writes.
+ *
+ * The marker is programmed last, so a partially written record never appears
+ * valid.
+ */
+#include "bootstate.h"
+
+#include "bootloader.h"
+
+#include "stm32f0xx.h"
+
+#include "drivers/flash.h"
+#include "drivers/errors.h"
+
+#include <stddef.h>
+
+/// marker of the current record
+#define BOOTSTATE_VALID			0xB007
+
+/**
+ * A boot state record.
+ */
+typedef struct {
+	/// CRC of the image that was installed when the record was written
+	uint32_t imageCrc;
+
+	/// firmware slot that is current
+	uint8_t slot;
+	/// complement of the slot
+	uint8_t slotCheck;
+	/// BOOTSTATE_VALID while the record is current, 0 once it's superseded
+	uint16_t marker;
+} bootstate_record_t;
+
+/// records in the boot state area
+#define BOOTSTATE_RECORDS		(BOOTLOADER_BOOTSTATE_SIZE / sizeof(bootstate_record_t))
+
+/// all records
+static const bootstate_record_t * const kRecords = (const bootstate_record_t *) BOOTLOADER_BOOTSTATE_ADDRESS;
+
+
+
+/**
+ * Returns whether the record is unused.
+ */
+static bool bootstate_is_free(const bootstate_record_t *record) {
+	return record->imageCrc == 0xFFFFFFFF && record->slot == 0xFF &&
+			record->slotCheck == 0xFF && record->marker == 0xFFFF;
+}
+
+/**
+ * Returns the index of the first free record, or BOOTSTATE_RECORDS if the area
+ * is full.
+ */
+static size_t bootstate_next(void) {
+	size_t low = 0, high = BOOTSTATE_RECORDS;
+
+	// records are written in order, so all free records are at the end
+	while(low < high) {
+		size_t mid = (low + high) / 2;
+
+		if(bootstate_is_free(&kRecords[mid])) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+
+	return low;
+}
+
+/**
+ * Returns the current record, or NULL if there is none. If writing a record
+ * was interrupted before the previous one was invalidated, that's the newer of
+ * the two.
+ */
+static const bootstate_record_t *bootstate_current(void) {
+	for(size_t i = bootstate_next(); i != 0; i--) {
+		const bootstate_record_t *record = &kRecords[i - 1];
+
+		if(record->marker == BOOTSTATE_VALID && (record->slot ^ record->slotCheck) == 0xFF) {
+			return record;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Programs 0 to the half-word at the given address. Unlike flash_program, this
+ * runs from flash (the core stalls until programming completes) since it's
+ * also called by applications, at which point the loader's RAM is gone.
+ */
+static int bootstate_program_zero(uint32_t address) {
+	uint32_t status;
+
+	FLASH->CR |= FLASH_CR_PG;
+	*((volatile uint16_t *) address) = 0;
+
+	while(FLASH->SR & FLASH_SR_BSY) {}
+
+	FLASH->CR &= ~FLASH_CR_PG;
+
+	status = FLASH->SR;
+	FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+
+	if(status & FLASH_SR_WRPRTERR) {
+		return kErrFlashWriteProtected;
+	} else if(status & FLASH_SR_PGERR) {
+		return kErrFlashProgram;
+	}
+
+	return kErrSuccess;
+}
+
+
+
+/**
+ * Checks whether the installed firmware can be booted directly: that is, there
+ * is a current record, and it was written for the installed image.
+ */
+bool bootstate_is_valid(void) {
+	const bootloader_version_t *installed = (const bootloader_version_t *) BOOTLOADER_VERSION_ADDRESS;
+	const bootstate_record_t *record = bootstate_current();
+
+	return record != NULL && record->imageCrc == installed->crc32;
+}
+
+/**
+ * Writes a record for the given slot, and the image currently installed. The
+ * previous record is invalidated once the new one is written.
+ */
+int bootstate_write(uint8_t slot) {
+	int err;
+
+	const bootloader_version_t *installed = (const bootloader_version_t *) BOOTLOADER_VERSION_ADDRESS;
+	const bootstate_record_t *previous = bootstate_current();
+	size_t next = bootstate_next();
+
+	err = flash_unlock();
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	// start over once the area is full
+	if(next == BOOTSTATE_RECORDS) {
+		for(uint32_t page = 0; err >= kErrSuccess && page < BOOTLOADER_BOOTSTATE_SIZE; page += FLASH_PAGE_SIZE) {
+			err = flash_erase_page(BOOTLOADER_BOOTSTATE_ADDRESS + page);
+		}
+
+		previous = NULL;
+		next = 0;
+	}
+
+	// write the record, then its marker
+	bootstate_record_t record = {
+		.imageCrc = installed->crc32,
+		.slot = slot,
+		.slotCheck = slot ^ 0xFF,
+		.marker = BOOTSTATE_VALID
+	};
+
+	uint32_t address = (uint32_t) &kRecords[next];
+
+	if(err >= kErrSuccess) {
+		err = flash_program(offsetof(bootstate_record_t, marker), &record, address);
+	}
+
+	if(err >= kErrSuccess) {
+		err = flash_program(sizeof(record.marker), &record.marker, address + offsetof(bootstate_record_t, marker));
+	}
+
+	// then invalidate the previous one
+	if(err >= kErrSuccess && previous != NULL) {
+		err = bootstate_program_zero((uint32_t) &previous->marker);
+	}
+
+	flash_lock();
+
+	return err;
+}
+
+/**
+ * Invalidates the current record, if any. This may be called by applications.
+ */
+int bootstate_invalidate(void) {
+	int err;
+	const bootstate_record_t *record = bootstate_current();
+
+	if(record == NULL) {
+		return kErrSuccess;
+	}
+
+	err = flash_unlock();
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	err = bootstate_program_zero((uint32_t) &record->marker);
+
+	flash_lock();
+
+	return err;
+}
@@ -0,0 +1,30 @@
+/*
+ * bootstate.h
+ *
+ * Boot state kept in internal flash, so that boots of firmware that is known
+ * to be good don't need to touch the SPI flash at all.
+ */
+
+#ifndef BOOTSTATE_H_
+#define BOOTSTATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Checks whether the installed firmware can be booted directly: that is, there
+ * is a current record, and it was written for the installed image.
+ */
+bool bootstate_is_valid(void);
+
+/**
+ * Writes a record for the given slot, and the image currently installed.
+ */
+int bootstate_write(uint8_t slot);
+
+/**
+ * Invalidates the current record, if any. This may be called by applications.
+ */
+int bootstate_invalidate(void);
+
+#endif /* BOOTSTATE_H_ */
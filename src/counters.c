@@ -0,0 +1,123 @@
+/*
+ * counters.c
+ *
+ * Each slot's counter is 32 bytes of the security register; a start clears the
+ * lowest set bit of the first byte that isn't zero yet. The register can only
+ * be erased as a whole, so resetting a counter means erasing it, then
+ * programming the other counters back.
+ *
+ * Counters are reset when their slot was marked good: that's recorded in the
+ * journal by the application, and the loader resets the counter on the next
+ * boot and records that in turn. If it's interrupted before that, the reset is
+ * simply repeated.
+ */
+#include "counters.h"
+
+#include "drivers/errors.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+/// contents of the security register
+static uint8_t gCounters[8 * COUNTERS_SLOT_SIZE];
+
+/**
+ * Returns the value of a slot's counter: the number of cleared bits, up to 255.
+ */
+static uint8_t counters_value(uint8_t slot) {
+	const uint8_t *counter = gCounters + (slot * COUNTERS_SLOT_SIZE);
+	unsigned int count = 0;
+
+	for(size_t i = 0; i < COUNTERS_SLOT_SIZE; i++) {
+		for(int bit = 0; bit < 8; bit++) {
+			if(!(counter[i] & (1 << bit))) {
+				count++;
+			}
+		}
+	}
+
+	return (count > 0xFF) ? 0xFF : count;
+}
+
+/**
+ * Reads all counters into the state, and resets the counters of slots that
+ * were marked good since they were last reset.
+ */
+int counters_load(const bootloader_flash_callbacks_t *flash, journal_t *journal) {
+	int err;
+
+	err = flash->flash_read_security(COUNTERS_ADDRESS, sizeof(gCounters), gCounters);
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	// reset counters, if they aren't already
+	if(journal->pendingResets != 0) {
+		bool erase = false;
+
+		for(uint8_t slot = 0; slot < 8; slot++) {
+			if((journal->pendingResets & (1 << slot)) && counters_value(slot) != 0) {
+				memset(gCounters + (slot * COUNTERS_SLOT_SIZE), 0xFF, COUNTERS_SLOT_SIZE);
+				erase = true;
+			}
+		}
+
+		if(erase) {
+			err = flash->flash_erase_security(COUNTERS_ADDRESS);
+
+			if(err >= kErrSuccess) {
+				err = flash->flash_write_security(COUNTERS_ADDRESS, sizeof(gCounters), gCounters);
+			}
+
+			if(err < kErrSuccess) {
+				return err;
+			}
+		}
+
+		for(uint8_t slot = 0; err >= kErrSuccess && slot < 8; slot++) {
+			if(journal->pendingResets & (1 << slot)) {
+				err = journal_append(flash, journal, kJournalCounterReset, slot);
+			}
+		}
+	}
+
+	// the counters are the authoritative start failure counts
+	for(uint8_t slot = 0; slot < 8; slot++) {
+		journal->info.fwInfo[slot].startFails = counters_value(slot);
+	}
+
+	return err;
+}
+
+/**
+ * Increments the counter for the given slot, by programming a single byte.
+ */
+int counters_increment(const bootloader_flash_callbacks_t *flash, journal_t *journal, uint8_t slot) {
+	int err = kErrSuccess;
+
+	if(slot >= 8) {
+		return kErrInvalidArgs;
+	}
+
+	uint8_t *counter = gCounters + (slot * COUNTERS_SLOT_SIZE);
+
+	for(size_t i = 0; i < COUNTERS_SLOT_SIZE; i++) {
+		if(counter[i] == 0) {
+			continue;
+		}
+
+		// clear the lowest bit that's still set
+		uint8_t byte = counter[i] & (counter[i] - 1);
+		err = flash->flash_write_security(COUNTERS_ADDRESS + (slot * COUNTERS_SLOT_SIZE) + i, sizeof(byte), &byte);
+
+		if(err >= kErrSuccess) {
+			counter[i] = byte;
+			journal->info.fwInfo[slot].startFails = counters_value(slot);
+		}
+
+		break;
+	}
+
+	return err;
+}
@@ -0,0 +1,32 @@
+/*
+ * counters.h
+ *
+ * Start failure counters for each firmware slot, kept in unary in one of the
+ * SPI flash's security registers: each start clears one more bit. Counting a
+ * start is then a single byte program, with no erase.
+ */
+
+#ifndef COUNTERS_H_
+#define COUNTERS_H_
+
+#include "journal.h"
+
+#include <stdint.h>
+
+/// address of the security register holding the counters
+#define COUNTERS_ADDRESS			0x1000
+/// bytes of counter for each slot; this is also the maximum count / 8
+#define COUNTERS_SLOT_SIZE			32
+
+/**
+ * Reads all counters into the state, and resets the counters of slots that
+ * were marked good since they were last reset.
+ */
+int counters_load(const bootloader_flash_callbacks_t *flash, journal_t *journal);
+
+/**
+ * Increments the counter for the given slot.
+ */
+int counters_increment(const bootloader_flash_callbacks_t *flash, journal_t *journal, uint8_t slot);
+
+#endif /* COUNTERS_H_ */
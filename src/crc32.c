@@ -0,0 +1,88 @@
+/*
+ * crc32.c
+ *
+ * On the STM32F0, the CRC is computed by the CRC peripheral: it is configured
+ * to reverse the bits of each input byte and of the output, which turns its
+ * MSB-first computation into the reflected CRC32. A running CRC is continued
+ * by loading its (bit reversed) inverse as the initial value.
+ *
+ * Elsewhere, or if CRC32_SOFTWARE is defined, a bitwise implementation without
+ * a lookup table is used: this is slower, but saves 1K of flash, which the
+ * loader doesn't have.
+ */
+#include "crc32.h"
+
+#if !defined(CRC32_SOFTWARE) && (defined(STM32F042) || defined(STM32F072))
+#define CRC32_HARDWARE
+#include "stm32f0xx.h"
+#endif
+
+/// reflected CRC32 polynomial
+#define CRC32_POLY				0xEDB88320UL
+/// CRC32 polynomial, as used by the CRC peripheral
+#define CRC32_POLY_NORMAL		0x04C11DB7UL
+
+#ifdef CRC32_HARDWARE
+/**
+ * Reverses the order of bits in a word. (Cortex-M0 has no RBIT instruction.)
+ */
+static uint32_t crc32_reverse(uint32_t x) {
+	x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+	x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+	x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+	x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+
+	return (x >> 16) | (x << 16);
+}
+
+/**
+ * Updates a running CRC with n bytes from the buffer, and returns the new
+ * CRC.
+ *
+ * The peripheral is set up on every call, since applications calling this
+ * through the loader interface may use it differently (or have disabled its
+ * clock.) It must not be used from an interrupt while this runs.
+ */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t nBytes) {
+	const uint8_t *bytes = (const uint8_t *) buf;
+	volatile uint8_t *dr = (volatile uint8_t *) &CRC->DR;
+
+	RCC->AHBENR |= RCC_AHBENR_CRCEN;
+
+	// 32-bit CRC32 polynomial (only the F07x can change it)
+#ifdef STM32F072
+	CRC->POL = CRC32_POLY_NORMAL;
+#endif
+	CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_OUT;
+
+	// continue from the given CRC
+	CRC->INIT = crc32_reverse(~crc);
+	CRC->CR |= CRC_CR_RESET;
+
+	while(nBytes--) {
+		*dr = *bytes++;
+	}
+
+	return ~CRC->DR;
+}
+#else
+/**
+ * Updates a running CRC with n bytes from the buffer, and returns the new
+ * CRC.
+ */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t nBytes) {
+	const uint8_t *bytes = (const uint8_t *) buf;
+
+	crc = ~crc;
+
+	while(nBytes--) {
+		crc ^= *bytes++;
+
+		for(int i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ (CRC32_POLY & -(crc & 1));
+		}
+	}
+
+	return ~crc;
+}
+#endif
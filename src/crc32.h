@@ -0,0 +1,21 @@
+/*
+ * crc32.h
+ *
+ * Computes the CRC32 used by zlib and Ethernet (reflected polynomial
+ * 0xEDB88320) over buffers, incrementally.
+ */
+
+#ifndef CRC32_H_
+#define CRC32_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Updates a running CRC with n bytes from the buffer, and returns the new
+ * CRC. Start with a CRC of 0; the result of each call can be passed to the
+ * next to continue.
+ */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t nBytes);
+
+#endif /* CRC32_H_ */
@@ -25,12 +25,34 @@ enum {
 	kErrSemaphoreCreationFailed	= -1003,
 	/// could not create a queue (xQueueCreate* returned NULL)
 	kErrQueueCreationFailed		= -1004,
+	/// an operation did not complete in the allotted time
+	kErrTimeout					= -1005,
 
 	/// an error occurred when receiving from a queue
 	kErrQueueReceive			= -1010,
 	/// an error occurred when sending to a queue
 	kErrQueueSend				= -1011,
 
+	// internal flash errors
+	/// the flash could not be unlocked
+	kErrFlashLocked				= -1100,
+	/// programming failed, because the location wasn't erased
+	kErrFlashProgram			= -1101,
+	/// the page is write protected
+	kErrFlashWriteProtected		= -1102,
+
+	// firmware image errors
+	/// there is no valid image in the slot
+	kErrImageInvalid			= -1200,
+	/// a delta image doesn't apply to the installed image
+	kErrImageBase				= -1201,
+	/// a block of an image doesn't match its CRC
+	kErrImageCorrupt			= -1202,
+
+	// boot state errors
+	/// neither the info block nor the journal hold a valid boot state
+	kErrBootStateCorrupt		= -1300,
+
 };
 
 
@@ -0,0 +1,111 @@
+/*
+ * flash.c
+ */
+#include "flash.h"
+
+#include "stm32f0xx.h"
+#include "errors.h"
+
+/// maximum number of polls of the busy flag before giving up (~100ms)
+#define FLASH_TIMEOUT_LOOPS		1000000
+
+/**
+ * Waits for the flash controller to finish the current operation, then checks
+ * and clears its error flags.
+ */
+FLASH_RAMFUNC static int flash_wait(void) {
+	uint32_t status;
+
+	for(uint32_t i = 0; (FLASH->SR & FLASH_SR_BSY); i++) {
+		if(i == FLASH_TIMEOUT_LOOPS) {
+			return kErrTimeout;
+		}
+	}
+
+	// clear status flags
+	status = FLASH->SR;
+	FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPRTERR;
+
+	if(status & FLASH_SR_WRPRTERR) {
+		return kErrFlashWriteProtected;
+	} else if(status & FLASH_SR_PGERR) {
+		return kErrFlashProgram;
+	}
+
+	return kErrSuccess;
+}
+
+
+
+/**
+ * Unlocks the flash for erasing and programming.
+ */
+int flash_unlock(void) {
+	if(FLASH->CR & FLASH_CR_LOCK) {
+		FLASH->KEYR = FLASH_FKEY1;
+		FLASH->KEYR = FLASH_FKEY2;
+	}
+
+	// a wrong key sequence locks the flash until the next reset
+	if(FLASH->CR & FLASH_CR_LOCK) {
+		return kErrFlashLocked;
+	}
+
+	return kErrSuccess;
+}
+
+/**
+ * Locks the flash again.
+ */
+void flash_lock(void) {
+	FLASH->CR |= FLASH_CR_LOCK;
+}
+
+/**
+ * Erases the page containing the specified address.
+ */
+FLASH_RAMFUNC int flash_erase_page(uint32_t address) {
+	int err;
+
+	FLASH->CR |= FLASH_CR_PER;
+	FLASH->AR = address;
+	FLASH->CR |= FLASH_CR_STRT;
+
+	err = flash_wait();
+
+	FLASH->CR &= ~FLASH_CR_PER;
+
+	return err;
+}
+
+/**
+ * Programs n bytes (a multiple of two) to the specified half-word aligned
+ * address. The area must have been erased previously.
+ */
+FLASH_RAMFUNC int flash_program(size_t nBytes, const void *buf, uint32_t address) {
+	int err = kErrSuccess;
+
+	const uint16_t *data = (const uint16_t *) buf;
+	volatile uint16_t *dest = (volatile uint16_t *) address;
+
+	// validate parameters
+	if((address & 1) || (nBytes & 1) || ((uint32_t) buf & 1)) {
+		return kErrInvalidArgs;
+	}
+
+	FLASH->CR |= FLASH_CR_PG;
+
+	for(size_t i = 0; i < (nBytes / 2); i++) {
+		*dest++ = *data++;
+
+		err = flash_wait();
+
+		if(err < kErrSuccess) {
+			break;
+		}
+	}
+
+	FLASH->CR &= ~FLASH_CR_PG;
+
+	return err;
+}
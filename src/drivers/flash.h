@@ -0,0 +1,48 @@
+/*
+ * flash.h
+ *
+ * Provides routines for erasing and programming the internal flash.
+ *
+ * The routines that wait on the flash controller are placed in RAM, so the
+ * core keeps executing (rather than stalling on instruction fetches) while
+ * the flash is busy.
+ */
+
+#ifndef FLASH_H_
+#define FLASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// size of an erasable page of internal flash
+#if defined(STM32F042)
+#define FLASH_PAGE_SIZE			0x400
+#elif defined(STM32F072)
+#define FLASH_PAGE_SIZE			0x800
+#endif
+
+/// places a function in RAM; it's copied there along with initialized data
+#define FLASH_RAMFUNC			__attribute__((section(".ramfunc"), long_call, noinline))
+
+/**
+ * Unlocks the flash for erasing and programming.
+ */
+int flash_unlock(void);
+
+/**
+ * Locks the flash again.
+ */
+void flash_lock(void);
+
+/**
+ * Erases the page containing the specified address.
+ */
+FLASH_RAMFUNC int flash_erase_page(uint32_t address);
+
+/**
+ * Programs n bytes (a multiple of two) to the specified half-word aligned
+ * address. The area must have been erased previously.
+ */
+FLASH_RAMFUNC int flash_program(size_t nBytes, const void *buf, uint32_t address);
+
+#endif /* FLASH_H_ */
@@ -16,6 +16,23 @@
 
 #include <stdint.h>
 
+/// DMA channel used for receiving data from SPI1
+#define SPI_DMA_RX			DMA1_Channel2
+/// DMA channel used for transmitting data to SPI1
+#define SPI_DMA_TX			DMA1_Channel3
+
+/// byte transmitted by DMA transfers without a transmit buffer
+static const uint8_t kDummyTx = 0x00;
+/// received bytes are written here by DMA transfers without a receive buffer
+static uint8_t gDummyRx;
+
+/// maximum number of bytes written to the TX FIFO but not yet read back; this
+/// is the size of the RX FIFO, so it can never overrun.
+#define SPI_MAX_IN_FLIGHT	4
+
+/// whether a DMA transfer has been started but not yet waited on
+static bool gDmaActive = false;
+
 /**
  * Initializes the SPI peripheral.
  */
@@ -60,11 +77,33 @@ void spi_init(void) {
 	for(volatile int i = 0; i < 32; i++) {}
 	RCC->APB2RSTR &= ~RCC_APB2RSTR_SPI1RST;
 
-	// configure SPI with fPCLK / 8 clock, master, mode 0, software /CS management, CS high
-	SPI1->CR1 |= SPI_CR1_BR_1 | SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI;
+	// configure SPI as master, mode 0, software /CS management, CS high
+	SPI1->CR1 |= SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI;
+	spi_set_prescaler(kSpiPrescalerDefault);
+
+	// 8 bit data size, RXNE on 8 bits, generate slave select
+	SPI1->CR2 |= (SPI_CR2_DS_0 | SPI_CR2_DS_1 | SPI_CR2_DS_2) | SPI_CR2_FRXTH | SPI_CR2_SSOE;
 
-	// 8 bit data size, generate slave select
-	SPI1->CR2 |= (SPI_CR2_DS_0 | SPI_CR2_DS_1 | SPI_CR2_DS_2) | SPI_CR2_SSOE;
+	// enable DMA clock; channels are configured per transfer
+	RCC->AHBENR |= RCC_AHBENR_DMAEN;
+}
+
+
+
+/**
+ * Changes the SPI clock prescaler. This may only be called outside of a
+ * transaction, since the BR field must not change while SPE is set.
+ */
+void spi_set_prescaler(spi_prescaler_t prescaler) {
+	uint16_t cr1 = SPI1->CR1 & (uint16_t) ~SPI_CR1_BR;
+	SPI1->CR1 = cr1 | (uint16_t) ((prescaler << 3) & SPI_CR1_BR);
+}
+
+/**
+ * Returns the currently selected SPI clock prescaler.
+ */
+spi_prescaler_t spi_get_prescaler(void) {
+	return (spi_prescaler_t) ((SPI1->CR1 & SPI_CR1_BR) >> 3);
 }
 
 
@@ -101,11 +140,178 @@ uint8_t spi_io(uint8_t out) {
 	// TX fifo empty?
 	while(!(SPI1->SR & SPI_SR_TXE)) {}
 
-	// write a byte
-	SPI1->DR = out;
+	// write a byte (a 16-bit access would push two bytes into the FIFO)
+	*((__IO uint8_t *) &SPI1->DR) = out;
 
 	// wait for RX fifo to not be empty
 	while(!(SPI1->SR & SPI_SR_RXNE)) {}
 
-	return (uint8_t) SPI1->DR;
+	return *((__IO uint8_t *) &SPI1->DR);
+}
+
+/**
+ * Exchanges len bytes without DMA, keeping the TX FIFO filled so there are no
+ * gaps between bytes. Either buffer may be NULL, as with spi_transfer().
+ *
+ * Up to SPI_MAX_IN_FLIGHT bytes are queued ahead of the receiver. Where at
+ * least two bytes remain, DR is accessed as a half-word, which packs two
+ * bytes into the FIFO at once.
+ */
+int spi_burst(const void *_tx, void *_rx, size_t len) {
+	const uint8_t *tx = (const uint8_t *) _tx;
+	uint8_t *rx = (uint8_t *) _rx;
+
+	size_t txLeft = len;
+	size_t rxLeft = len;
+
+	while(rxLeft != 0) {
+		size_t inFlight = rxLeft - txLeft;
+
+		// TXE means at least half of the TX FIFO (two bytes) is free
+		if(txLeft != 0 && (SPI1->SR & SPI_SR_TXE)) {
+			if(txLeft >= 2 && inFlight <= (SPI_MAX_IN_FLIGHT - 2)) {
+				uint16_t out = 0;
+
+				if(tx != NULL) {
+					out = (uint16_t) (tx[0] | (tx[1] << 8));
+					tx += 2;
+				}
+
+				SPI1->DR = out;
+				txLeft -= 2;
+			} else if(inFlight < SPI_MAX_IN_FLIGHT) {
+				*((__IO uint8_t *) &SPI1->DR) = (tx != NULL) ? *tx++ : 0x00;
+				txLeft--;
+			}
+		}
+
+		// drain the RX FIFO: two bytes at a time if it's at least half full
+		uint16_t level = SPI1->SR & SPI_SR_FRLVL;
+
+		if(level >= SPI_SR_FRLVL_1 && rxLeft >= 2) {
+			uint16_t in = SPI1->DR;
+
+			if(rx != NULL) {
+				*rx++ = (uint8_t) (in & 0xFF);
+				*rx++ = (uint8_t) (in >> 8);
+			}
+
+			rxLeft -= 2;
+		} else if(level != 0) {
+			uint8_t in = *((__IO uint8_t *) &SPI1->DR);
+
+			if(rx != NULL) {
+				*rx++ = in;
+			}
+
+			rxLeft--;
+		}
+	}
+
+	return kErrSuccess;
+}
+
+
+
+/**
+ * Starts a DMA transfer of len bytes: bytes are written from tx and the bytes
+ * read back are stored in rx. Either buffer may be NULL: in that case, zeros
+ * are transmitted, or the received data is discarded.
+ *
+ * The receive channel is always used, even if the data is discarded, so the
+ * RX FIFO never overruns; its transfer complete flag indicates that the last
+ * byte has been clocked out.
+ */
+int spi_transfer(const void *tx, void *rx, size_t len) {
+	// validate parameters
+	if(len > 0xFFFF || gDmaActive) {
+		return kErrInvalidArgs;
+	} else if(len == 0) {
+		return kErrSuccess;
+	}
+
+	// set up the receive channel first, so no bytes are missed
+	SPI_DMA_RX->CCR = 0;
+	SPI_DMA_RX->CPAR = (uint32_t) &SPI1->DR;
+	SPI_DMA_RX->CNDTR = len;
+
+	if(rx != NULL) {
+		SPI_DMA_RX->CMAR = (uint32_t) rx;
+		SPI_DMA_RX->CCR = DMA_CCR_MINC | DMA_CCR_PL_1;
+	} else {
+		SPI_DMA_RX->CMAR = (uint32_t) &gDummyRx;
+		SPI_DMA_RX->CCR = DMA_CCR_PL_1;
+	}
+
+	// then the transmit channel (memory to peripheral)
+	SPI_DMA_TX->CCR = 0;
+	SPI_DMA_TX->CPAR = (uint32_t) &SPI1->DR;
+	SPI_DMA_TX->CNDTR = len;
+
+	if(tx != NULL) {
+		SPI_DMA_TX->CMAR = (uint32_t) tx;
+		SPI_DMA_TX->CCR = DMA_CCR_MINC | DMA_CCR_DIR;
+	} else {
+		SPI_DMA_TX->CMAR = (uint32_t) &kDummyTx;
+		SPI_DMA_TX->CCR = DMA_CCR_DIR;
+	}
+
+	// clear any stale flags for both channels
+	DMA1->IFCR = DMA_IFCR_CGIF2 | DMA_IFCR_CGIF3;
+
+	// enable RX DMA, both channels, then TX DMA (RM0091 28.5.9)
+	SPI1->CR2 |= SPI_CR2_RXDMAEN;
+
+	SPI_DMA_RX->CCR |= DMA_CCR_EN;
+	SPI_DMA_TX->CCR |= DMA_CCR_EN;
+
+	SPI1->CR2 |= SPI_CR2_TXDMAEN;
+
+	gDmaActive = true;
+	return kErrSuccess;
+}
+
+/**
+ * Starts a DMA transfer that receives len bytes into buf, transmitting zeros.
+ */
+int spi_receive(void *buf, size_t len) {
+	if(buf == NULL) {
+		return kErrInvalidArgs;
+	}
+
+	return spi_transfer(NULL, buf, len);
+}
+
+/**
+ * Checks whether the last DMA transfer has completed.
+ */
+bool spi_transfer_done(void) {
+	if(!gDmaActive) {
+		return true;
+	}
+
+	return (DMA1->ISR & DMA_ISR_TCIF2);
+}
+
+/**
+ * Waits for the last DMA transfer to complete, then releases the DMA channels.
+ */
+void spi_wait(void) {
+	// nothing to do if no transfer is in progress
+	if(!gDmaActive) {
+		return;
+	}
+
+	// wait for the last byte to be received
+	while(!(DMA1->ISR & DMA_ISR_TCIF2)) {}
+
+	// disable DMA requests and the channels
+	SPI1->CR2 &= (uint16_t) ~(SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+
+	SPI_DMA_TX->CCR = 0;
+	SPI_DMA_RX->CCR = 0;
+
+	DMA1->IFCR = DMA_IFCR_CGIF2 | DMA_IFCR_CGIF3;
+
+	gDmaActive = false;
 }
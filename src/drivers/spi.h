@@ -13,13 +13,46 @@
 #ifndef SPI_H_
 #define SPI_H_
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/**
+ * SPI clock prescalers, as a divisor of fPCLK. These correspond directly to
+ * the values of the BR field in SPI_CR1.
+ */
+typedef enum {
+	kSpiPrescaler2				= 0,
+	kSpiPrescaler4				= 1,
+	kSpiPrescaler8				= 2,
+	kSpiPrescaler16				= 3,
+	kSpiPrescaler32				= 4,
+	kSpiPrescaler64				= 5,
+	kSpiPrescaler128			= 6,
+	kSpiPrescaler256			= 7,
+
+	/// prescaler used after initialization
+	kSpiPrescalerDefault		= kSpiPrescaler8,
+} spi_prescaler_t;
+
+
+
 /**
  * Initializes the SPI peripheral.
  */
 void spi_init(void);
 
+/**
+ * Changes the SPI clock prescaler. This may only be called outside of a
+ * transaction.
+ */
+void spi_set_prescaler(spi_prescaler_t prescaler);
+
+/**
+ * Returns the currently selected SPI clock prescaler.
+ */
+spi_prescaler_t spi_get_prescaler(void);
+
 
 
 /**
@@ -39,5 +72,38 @@ void spi_end(void);
  */
 uint8_t spi_io(uint8_t out);
 
+/**
+ * Exchanges len bytes without DMA, keeping the TX FIFO filled so there are no
+ * gaps between bytes. Either buffer may be NULL, as with spi_transfer().
+ */
+int spi_burst(const void *tx, void *rx, size_t len);
+
+
+
+/**
+ * Starts a DMA transfer of len bytes: bytes are written from tx and the bytes
+ * read back are stored in rx. Either buffer may be NULL: in that case, zeros
+ * are transmitted, or the received data is discarded.
+ *
+ * This returns immediately; the transfer must be completed with spi_wait()
+ * before the transaction is ended or another transfer is started.
+ */
+int spi_transfer(const void *tx, void *rx, size_t len);
+
+/**
+ * Starts a DMA transfer that receives len bytes into buf, transmitting zeros.
+ */
+int spi_receive(void *buf, size_t len);
+
+/**
+ * Checks whether the last DMA transfer has completed.
+ */
+bool spi_transfer_done(void);
+
+/**
+ * Waits for the last DMA transfer to complete, then releases the DMA channels.
+ */
+void spi_wait(void);
+
 
 #endif /* SPI_H_ */
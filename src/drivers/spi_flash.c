@@ -8,31 +8,134 @@
 #include "spi_flash_private.h"
 
 #include "spi.h"
+#include "systick.h"
 
 #include "errors.h"
 
 /**
- * Initializes the SPI flash: reads vendor info.
+ * Timing information used while waiting for the flash to complete an internal
+ * operation. All times are in milliseconds and derived from the AT25SF041
+ * datasheet (typical and maximum times.)
+ */
+typedef struct {
+	/// time after which the status register is first polled
+	uint16_t initialDelay;
+	/// time between successive polls; 0 streams the status continuously
+	uint16_t pollInterval;
+	/// time after which the operation is considered failed
+	uint16_t timeout;
+} spiflash_timing_t;
+
+static const spiflash_timing_t kSpiFlashTimings[] = {
+	[kSpiFlashOpNone]			= {0, 0, 0},
+	// worst case: a 64K block erase was in progress before reset
+	[kSpiFlashOpUnknown]		= {0, 1, 2001},
+	// tPP: 0.4ms typical, 2.5ms max
+	[kSpiFlashOpProgram]		= {0, 0, 4},
+	// tBE1: 60ms typical, 300ms max
+	[kSpiFlashOpErase4K]		= {40, 2, 301},
+	// tBE2: 250ms typical, 1300ms max
+	[kSpiFlashOpErase32K]		= {200, 5, 1301},
+	// tBE3: 400ms typical, 2000ms max
+	[kSpiFlashOpErase64K]		= {300, 5, 2001},
+	// same as a 4K block erase
+	[kSpiFlashOpEraseSecurity]	= {40, 2, 301},
+};
+
+/// number of bytes checked at a time by spiflash_is_blank()
+#define SPIFLASH_BLANK_CHUNK		32
+
+/// operation the flash may currently be busy with
+static spiflash_op_t gPendingOp = kSpiFlashOpUnknown;
+
+#ifdef SPIFLASH_CALIBRATE_CLOCK
+/// number of times the JEDEC ID must read back correctly to accept a clock
+#define SPIFLASH_ID_VERIFY_COUNT	4
+#endif
+
+/**
+ * Initializes the SPI flash: waits for any operation in progress to complete.
+ *
+ * If SPIFLASH_CALIBRATE_CLOCK is defined, the JEDEC ID is then read at the
+ * default clock as a reference, and the fastest SPI clock at which the ID
+ * reads back consistently is selected. The loader doesn't have the flash to
+ * spare for this by default, so it stays at the default clock.
  */
 void spiflash_init(void) {
 	int err;
 
 	// wait for flash to be idle
-	spiflash_wait_for_idle();
+	err = spiflash_wait_for_idle();
+
+	if(err < kErrSuccess) {
+		return;
+	}
+
+#ifdef SPIFLASH_CALIBRATE_CLOCK
+
+	// read the manufacturer/chip id at the default clock
+	uint8_t idBuffer[3];
+
+	err = spiflash_read_id(idBuffer);
+
+	// handle errors (or no flash responding) by staying at the default clock
+	if(err < kErrSuccess) {
+		return;
+	} else if(idBuffer[0] == 0x00 || idBuffer[0] == 0xFF) {
+		return;
+	}
+
+	// find the fastest clock at which the id reads back properly
+	spi_prescaler_t prescaler;
 
-	// start an SPI transaction to read manufacturer/chip id
-	uint8_t idBuffer[4];
+	for(prescaler = kSpiPrescaler2; prescaler < kSpiPrescalerDefault; prescaler++) {
+		spi_set_prescaler(prescaler);
+
+		if(spiflash_verify_id(idBuffer)) {
+			return;
+		}
+	}
+
+	// if we get here, no faster clock works
+	spi_set_prescaler(kSpiPrescalerDefault);
+#endif
+}
+
+/**
+ * Reads the three byte JEDEC manufacturer/device ID.
+ */
+int spiflash_read_id(uint8_t *id) {
+	int err;
 	uint8_t idCommand[1] = {0x9F};
 
 	spi_begin();
-	err = spiflash_command(&idCommand, sizeof(idCommand), &idBuffer, sizeof(idBuffer));
+	err = spiflash_command(&idCommand, sizeof(idCommand), id, 3);
 	spi_end();
 
-	// handle errors, then log id info
-	if(err < kErrSuccess) {
-		return;
+	return err;
+}
+
+#ifdef SPIFLASH_CALIBRATE_CLOCK
+/**
+ * Reads the JEDEC ID several times at the current clock and checks whether it
+ * matches the given reference each time.
+ */
+bool spiflash_verify_id(const uint8_t *reference) {
+	uint8_t id[3];
+
+	for(int i = 0; i < SPIFLASH_ID_VERIFY_COUNT; i++) {
+		if(spiflash_read_id(id) < kErrSuccess) {
+			return false;
+		}
+
+		if(id[0] != reference[0] || id[1] != reference[1] || id[2] != reference[2]) {
+			return false;
+		}
 	}
+
+	return true;
 }
+#endif
 
 /**
  * Reads n bytes from the flash, starting at the specified address.
@@ -40,9 +143,44 @@ void spiflash_init(void) {
 int spiflash_read(size_t nBytes, void *buf, uint32_t address) {
 	return spiflash_read_internal(0x0B, nBytes, buf, address);
 }
+/**
+ * Starts reading n bytes from the flash into the buffer in the background. The
+ * read must be completed with spiflash_read_finish() before any other flash
+ * access; the buffer must not be accessed until then.
+ *
+ * The data is received by DMA, so the caller is free to do other work.
+ */
+int spiflash_read_start(size_t nBytes, void *buf, uint32_t address) {
+	int err;
+
+	// validate parameters
+	if(buf == NULL) {
+		return kErrInvalidArgs;
+	}
+
+	err = spiflash_begin_read(0x0B, address);
+
+	if(err >= kErrSuccess) {
+		err = spi_receive(buf, nBytes);
+	}
+
+	// on failure, end the transaction right away
+	if(err < kErrSuccess) {
+		spi_end();
+	}
+
+	return err;
+}
+/**
+ * Waits for a read started with spiflash_read_start() to complete.
+ */
+void spiflash_read_finish(void) {
+	spi_wait();
+	spi_end();
+}
 /**
  * Reads n bytes from the flash's security register. The register is specified
- * by bits 9-8 of the address.
+ * by bits 13-12 of the address.
  */
 int spiflash_read_security(size_t nBytes, void *buf, uint32_t address) {
 	return spiflash_read_internal(0x48, nBytes, buf, address);
@@ -60,19 +198,115 @@ int spiflash_read_internal(uint8_t command, size_t nBytes, void *buf, uint32_t a
 		return kErrInvalidArgs;
 	}
 
+	// send the command, then receive the data via DMA
+	err = spiflash_begin_read(command, address);
+
+	if(err >= kErrSuccess) {
+		err = spi_receive(buf, nBytes);
+		spi_wait();
+	}
+
+	spi_end();
+
+	return err;
+}
+
+/**
+ * Begins a read transaction: once the flash is idle, /CS is asserted and the
+ * read command with the given address (and a dummy byte) is sent. Data can
+ * then be clocked out until the transaction is ended with spi_end().
+ *
+ * @note The transaction is begun even if an error is returned.
+ */
+int spiflash_begin_read(uint8_t command, uint32_t address) {
+	int err;
+
 	// wait for the flash to be idle
-	spiflash_wait_for_idle();
+	err = spiflash_wait_for_idle();
+
+	spi_begin();
+
+	if(err < kErrSuccess) {
+		return err;
+	}
 
 	// set up command (with the dummy byte)
 	uint8_t readCommand[5] = {command, 0, 0, 0, 0};
 
-	readCommand[2] = (address & 0x00FF0000) >> 16;
-	readCommand[3] = (address & 0x0000FF00) >> 8;
-	readCommand[4] = (address & 0x000000FF) >> 0;
+	readCommand[1] = (address & 0x00FF0000) >> 16;
+	readCommand[2] = (address & 0x0000FF00) >> 8;
+	readCommand[3] = (address & 0x000000FF) >> 0;
 
-	// execute the command
-	spi_begin();
-	err = spiflash_command(&readCommand, sizeof(readCommand), buf, nBytes);
+	return spiflash_command(&readCommand, sizeof(readCommand), NULL, 0);
+}
+
+
+
+/**
+ * Checks whether n bytes starting at the specified address are all erased
+ * (0xFF.)
+ *
+ * The data is read in a single transaction: while one chunk is checked, the
+ * next one is already being received by DMA. Reading stops at the first byte
+ * that isn't erased.
+ */
+int spiflash_is_blank(size_t nBytes, uint32_t address, bool *blank) {
+	int err;
+
+	// two word-aligned chunk buffers, filled alternately
+	uint32_t chunks[2][SPIFLASH_BLANK_CHUNK / 4];
+	size_t chunkLen[2];
+	int current = 0;
+
+	if(blank == NULL) {
+		return kErrInvalidArgs;
+	}
+
+	*blank = true;
+
+	// start reading the first chunk
+	err = spiflash_begin_read(0x0B, address);
+
+	chunkLen[0] = (nBytes > SPIFLASH_BLANK_CHUNK) ? SPIFLASH_BLANK_CHUNK : nBytes;
+	nBytes -= chunkLen[0];
+
+	if(err >= kErrSuccess) {
+		err = spi_receive(chunks[0], chunkLen[0]);
+	}
+
+	while(err >= kErrSuccess && chunkLen[current] != 0) {
+		spi_wait();
+
+		// start receiving the next chunk into the other buffer
+		int next = current ^ 1;
+
+		chunkLen[next] = (nBytes > SPIFLASH_BLANK_CHUNK) ? SPIFLASH_BLANK_CHUNK : nBytes;
+		nBytes -= chunkLen[next];
+
+		err = spi_receive(chunks[next], chunkLen[next]);
+
+		// check the chunk we've got: whole words, then the remaining bytes
+		size_t words = chunkLen[current] / 4;
+
+		for(size_t i = 0; i < words; i++) {
+			if(chunks[current][i] != 0xFFFFFFFF) {
+				*blank = false;
+			}
+		}
+		for(size_t i = words * 4; i < chunkLen[current]; i++) {
+			if(((uint8_t *) chunks[current])[i] != 0xFF) {
+				*blank = false;
+			}
+		}
+
+		if(!*blank) {
+			break;
+		}
+
+		current = next;
+	}
+
+	spi_wait();
 	spi_end();
 
 	return err;
@@ -93,6 +327,45 @@ int spiflash_read_internal(uint8_t command, size_t nBytes, void *buf, uint32_t a
 int spiflash_write(size_t nBytes, void *buf, uint32_t address) {
 	return spiflash_write_page_internal(0x02, nBytes, buf, address);
 }
+/**
+ * Programs n bytes starting at the specified address, splitting the data at
+ * page boundaries. The pages must have been erased previously.
+ *
+ * Each page program is issued as soon as the previous one has completed. Pages
+ * whose data is all 0xFF are skipped.
+ */
+int spiflash_program_range(size_t nBytes, void *buf, uint32_t address) {
+	int err;
+	uint8_t *data = (uint8_t *) buf;
+
+	if(buf == NULL) {
+		return kErrInvalidArgs;
+	}
+
+	while(nBytes != 0) {
+		// write up to the end of the page
+		size_t chunk = 0x100 - (address & 0xFF);
+
+		if(chunk > nBytes) {
+			chunk = nBytes;
+		}
+
+		// programming 0xFF doesn't change erased flash, so skip such pages
+		if(!spiflash_buffer_is_blank(data, chunk)) {
+			err = spiflash_write_page_internal(0x02, chunk, data, address);
+
+			if(err < kErrSuccess) {
+				return err;
+			}
+		}
+
+		data += chunk;
+		address += chunk;
+		nBytes -= chunk;
+	}
+
+	return kErrSuccess;
+}
 /**
  * Writes n (at most 256) bytes to the address in the security register space of
  * the flash.
@@ -119,7 +392,11 @@ int spiflash_write_page_internal(uint8_t command, size_t nBytes, void *buf, uint
 	}
 
 	// wait for the flash to be idle
-	spiflash_wait_for_idle();
+	err = spiflash_wait_for_idle();
+
+	if(err < kErrSuccess) {
+		return err;
+	}
 
 	// enable writing
 	err = spiflash_write_enable();
@@ -130,9 +407,9 @@ int spiflash_write_page_internal(uint8_t command, size_t nBytes, void *buf, uint
 
 	// send the write command
 	uint8_t writeCmd[4] = {command, 0, 0, 0};
-	writeCmd[2] = (address & 0x00FF0000) >> 16;
-	writeCmd[3] = (address & 0x0000FF00) >> 8;
-	writeCmd[4] = (address & 0x000000FF) >> 0;
+	writeCmd[1] = (address & 0x00FF0000) >> 16;
+	writeCmd[2] = (address & 0x0000FF00) >> 8;
+	writeCmd[3] = (address & 0x000000FF) >> 0;
 
 	spi_begin();
 	err = spiflash_command(&writeCmd, sizeof(writeCmd), NULL, 0);
@@ -142,53 +419,246 @@ int spiflash_write_page_internal(uint8_t command, size_t nBytes, void *buf, uint
 		return err;
 	}
 
-	// now, send the data
-	err = spiflash_command(buf, nBytes, NULL, 0);
+	// now, send the data via DMA
+	err = spi_transfer(buf, NULL, nBytes);
+	spi_wait();
 	spi_end();
 
 	if(err < kErrSuccess) {
 		return err;
 	}
 
-	// disable writing
-	err = spiflash_write_disable();
+	// the flash clears the write enable latch once programming completes
+	gPendingOp = kSpiFlashOpProgram;
 
-	return err;
+	return kErrSuccess;
 }
 
 
 
+#ifdef SPIFLASH_UPDATE
+/**
+ * Updates n bytes (a multiple of 4K) starting at the specified (4K aligned)
+ * address with the given data, erasing and programming only where the contents
+ * differ. Statistics are written to stats, if specified.
+ *
+ * This is only built if SPIFLASH_UPDATE is defined; the loader itself never
+ * writes firmware to the SPI flash.
+ *
+ * Each sector is first compared against the new data, page by page. Sectors
+ * that are identical are skipped; if the new data only clears bits, the pages
+ * that differ are programmed in place. Otherwise, the sector is erased and all
+ * of its pages are programmed.
+ *
+ * Whole sectors are required, since erasing a partial sector would also erase
+ * whatever follows the data in it.
+ */
+int spiflash_update(size_t nBytes, void *buf, uint32_t address, spiflash_update_stats_t *stats) {
+	int err;
+	uint8_t *data = (uint8_t *) buf;
+
+	// validate inputs
+	if(buf == NULL || (address & 0xFFF) != 0 || (nBytes & 0xFFF) != 0 ||
+			address >= SPIFLASH_SIZE || nBytes > (SPIFLASH_SIZE - address)) {
+		return kErrInvalidArgs;
+	}
+
+	if(stats != NULL) {
+		stats->skipped = stats->programmed = stats->erased = 0;
+	}
+
+	while(nBytes != 0) {
+		size_t sectorLen = (nBytes > 0x1000) ? 0x1000 : nBytes;
+
+		// compare the sector contents against the new data
+		uint8_t stored[SPIFLASH_BLANK_CHUNK];
+		uint16_t differs = 0;
+		bool needsErase = false;
+
+		err = spiflash_begin_read(0x0B, address);
+
+		for(size_t off = 0; off < sectorLen && err >= kErrSuccess; off += sizeof(stored)) {
+			size_t chunk = sectorLen - off;
+
+			if(chunk > sizeof(stored)) {
+				chunk = sizeof(stored);
+			}
+
+			err = spi_burst(NULL, stored, chunk);
+
+			for(size_t i = 0; i < chunk; i++) {
+				uint8_t byte = data[off + i];
+
+				if(stored[i] != byte) {
+					differs |= (1 << ((off + i) / 0x100));
+
+					// programming can only clear bits
+					if((stored[i] & byte) != byte) {
+						needsErase = true;
+					}
+				}
+			}
+		}
+
+		spi_end();
+
+		if(err < kErrSuccess) {
+			return err;
+		}
+
+		// then write whatever is needed
+		if(differs == 0) {
+			if(stats != NULL) {
+				stats->skipped++;
+			}
+		} else if(!needsErase) {
+			for(size_t off = 0; off < sectorLen; off += 0x100) {
+				if(differs & (1 << (off / 0x100))) {
+					size_t pageLen = sectorLen - off;
+
+					err = spiflash_write((pageLen > 0x100) ? 0x100 : pageLen, data + off, address + off);
+
+					if(err < kErrSuccess) {
+						return err;
+					}
+				}
+			}
+
+			if(stats != NULL) {
+				stats->programmed++;
+			}
+		} else {
+			err = spiflash_erase_block_internal(0x20, address);
+
+			if(err < kErrSuccess) {
+				return err;
+			}
+
+			err = spiflash_program_range(sectorLen, data, address);
+
+			if(err < kErrSuccess) {
+				return err;
+			}
+
+			if(stats != NULL) {
+				stats->erased++;
+			}
+		}
+
+		data += sectorLen;
+		address += sectorLen;
+		nBytes -= sectorLen;
+	}
+
+	return kErrSuccess;
+}
+#endif
+
+#ifdef SPIFLASH_ERASE_SKIP_BLANK
+/**
+ * Erases the block at the given address with the given command, skipping 4K
+ * blocks in it that are already erased. If only a few of the 4K blocks need
+ * erasing, they're erased individually instead.
+ */
+static int spiflash_erase_dirty(uint8_t command, uint32_t blockSize, uint32_t address) {
+	int err;
+
+	// find the 4K blocks that aren't erased yet
+	int numSectors = blockSize / 0x1000;
+	int numDirty = 0;
+	uint16_t dirty = 0;
+
+	for(int i = 0; i < numSectors; i++) {
+		bool blank;
+		err = spiflash_is_blank(0x1000, address + (i * 0x1000), &blank);
+
+		if(err < kErrSuccess) {
+			return err;
+		}
+
+		if(!blank) {
+			dirty |= (1 << i);
+			numDirty++;
+		}
+	}
+
+	// a large erase takes about as long as four 4K erases
+	if(numDirty == 0) {
+		return kErrSuccess;
+	} else if(numSectors > 1 && (numDirty * 4) <= numSectors) {
+		for(int i = 0; i < numSectors; i++) {
+			if(dirty & (1 << i)) {
+				err = spiflash_erase_block_internal(0x20, address + (i * 0x1000));
+
+				if(err < kErrSuccess) {
+					return err;
+				}
+			}
+		}
+
+		return kErrSuccess;
+	}
+
+	return spiflash_erase_block_internal(command, address);
+}
+#endif
+
 /**
  * Erases n bytes starting at the specified address, in the most efficient way
  * possible.
  *
- * TODO: make this smart lol
+ * The range is rounded out to 4K block boundaries. 64K and 32K block erases are
+ * used wherever the range covers a whole, aligned block of that size; 4K
+ * erases are only used for the remainder at the edges.
+ *
+ * If SPIFLASH_ERASE_SKIP_BLANK is defined, 4K blocks that are already erased
+ * are skipped; the loader leaves this out by default, to save flash.
+ *
+ * The range must lie within the flash; otherwise, nothing is erased.
  */
 int spiflash_erase(size_t nBytes, uint32_t address) {
 	int err = kErrSuccess;
 
-	// align address to a 4K block
-	address &= 0x00FFF000;
-
-	// erase however many 4K blocks we need to
-	int numBlocks = ((int) nBytes) / 0x1000;
-
-	if(numBlocks == 0) {
+	if(nBytes == 0) {
 		return kErrSuccess;
+	} else if(address >= SPIFLASH_SIZE || nBytes > (SPIFLASH_SIZE - address)) {
+		return kErrInvalidArgs;
 	}
 
-	// begin erasing
-	for(int i = 0; i < numBlocks; i++) {
-		// call through to the erase block function
-		err = spiflash_erase_block_internal(0x20, address);
+	// round the range out to 4K blocks
+	uint32_t end = (address + nBytes + 0xFFF) & 0x00FFF000;
+	address &= 0x00FFF000;
+
+	// erase with the largest block that fits at each address
+	while(address < end) {
+		uint32_t remaining = end - address;
+
+		uint8_t command;
+		uint32_t blockSize;
+
+		if((address & 0xFFFF) == 0 && remaining >= 0x10000) {
+			command = 0xD8;
+			blockSize = 0x10000;
+		} else if((address & 0x7FFF) == 0 && remaining >= 0x8000) {
+			command = 0x52;
+			blockSize = 0x8000;
+		} else {
+			command = 0x20;
+			blockSize = 0x1000;
+		}
+
+#ifdef SPIFLASH_ERASE_SKIP_BLANK
+		err = spiflash_erase_dirty(command, blockSize, address);
+#else
+		err = spiflash_erase_block_internal(command, address);
+#endif
 
 		// handle errors by leaving the loop
 		if(err < kErrSuccess) {
 			break;
 		}
 
-		// increment address
-		address += 0x1000;
+		address += blockSize;
 	}
 
 	// return error code
@@ -206,13 +676,18 @@ int spiflash_erase_security(uint32_t address) {
  * Erases a single page at the given address, using the specified command.
  *
  * @note Unlike the other internal functions, this function DOES NOT disable
- * write protection by itself. You need to do that outside of this function.
+ * write protection afterwards: the flash clears the write enable latch by
+ * itself once the erase completes.
  */
 int spiflash_erase_block_internal(uint8_t command, uint32_t address) {
 	int err;
 
 	// wait for flash to be idle
-	spiflash_wait_for_idle();
+	err = spiflash_wait_for_idle();
+
+	if(err < kErrSuccess) {
+		return err;
+	}
 
 	// enable writing
 	err = spiflash_write_enable();
@@ -223,9 +698,9 @@ int spiflash_erase_block_internal(uint8_t command, uint32_t address) {
 
 	// set up the block erase command
 	uint8_t eraseCmd[4] = {command, 0, 0, 0};
-	eraseCmd[2] = (address & 0x00FF0000) >> 16;
-	eraseCmd[3] = (address & 0x0000FF00) >> 8;
-	eraseCmd[4] = (address & 0x000000FF) >> 0;
+	eraseCmd[1] = (address & 0x00FF0000) >> 16;
+	eraseCmd[2] = (address & 0x0000FF00) >> 8;
+	eraseCmd[3] = (address & 0x000000FF) >> 0;
 
 	// execute command
 	spi_begin();
@@ -236,9 +711,23 @@ int spiflash_erase_block_internal(uint8_t command, uint32_t address) {
 		return err;
 	}
 
-	// disable writing again
-	err = spiflash_write_disable();
-	return err;
+	// select the timing used when waiting for the erase to complete
+	switch(command) {
+		case 0x52:
+			gPendingOp = kSpiFlashOpErase32K;
+			break;
+		case 0xD8:
+			gPendingOp = kSpiFlashOpErase64K;
+			break;
+		case 0x44:
+			gPendingOp = kSpiFlashOpEraseSecurity;
+			break;
+		default:
+			gPendingOp = kSpiFlashOpErase4K;
+			break;
+	}
+
+	return kErrSuccess;
 }
 
 
@@ -247,122 +736,88 @@ int spiflash_erase_block_internal(uint8_t command, uint32_t address) {
  * Writes a command to the chip, then reads zero or more bytes of response.
  */
 int spiflash_command(void *_command, size_t commandLen, void *_response, size_t responseLen) {
-	int bytesRead = 0;
+	int err;
 
 	// write the command
-	uint8_t *command = (uint8_t *) _command;
+	err = spi_burst(_command, NULL, commandLen);
 
-	for(size_t i = 0; i < commandLen; i++) {
-		spi_io(*command++);
+	if(err < kErrSuccess) {
+		return err;
 	}
 
 	// should we read a response?
 	if(responseLen != 0) {
-		uint8_t *response = (uint8_t *) _response;
+		err = spi_burst(NULL, _response, responseLen);
 
-		for(size_t i = 0; i < responseLen; i++) {
-			*response++ = spi_io(0x00);
+		if(err < kErrSuccess) {
+			return err;
 		}
 	}
 
 	// return the number of bytes we read
-	return bytesRead;
+	return (int) responseLen;
 }
 
 
 
 /**
- * Reads out the status register.
+ * Waits until the flash has completed the last operation started, or until
+ * the timeout for that type of operation expires.
+ *
+ * If no operation is pending, this returns immediately. Otherwise, /CS is held
+ * after sending the read status command, and the status register is clocked
+ * out repeatedly at the interval given by the timing table. The status is
+ * sampled once before the initial delay, since the caller may have done other
+ * work since starting the operation.
  */
-int spiflash_get_status(uint16_t *status) {
-	int err;
-
-	uint8_t temp;
-	uint8_t command[1];
-
-	// clear the status register
-	if(status == NULL) {
-		return kErrInvalidArgs;
-	}
-
-	*status = 0;
-
-	// read the first byte of the register
-	command[0] = 0x05;
-
-	spi_begin();
-	err = spiflash_command(&command, sizeof(command), &temp, sizeof(temp));
-	spi_end();
-
-	if(err < kErrSuccess) {
-		return err;
-	}
-
-	*status |= (uint16_t) (temp << 8);
-
-	// read the second byte of the register
-	command[0] = 0x35;
-
-	spi_begin();
-	err = spiflash_command(&command, sizeof(command), &temp, sizeof(temp));
-	spi_end();
+int spiflash_wait_for_idle(void) {
+	int err = kErrSuccess;
 
-	if(err < kErrSuccess) {
-		return err;
+	// nothing to wait for
+	if(gPendingOp == kSpiFlashOpNone) {
+		return kErrSuccess;
 	}
 
-	*status |= (uint16_t) temp;
+	const spiflash_timing_t *timing = &kSpiFlashTimings[gPendingOp];
 
-	// if we get here, it was successful
-	return kErrSuccess;
-}
+	// sample once right away, in case the operation completed in the meantime
+	uint16_t elapsed = 0;
+	uint16_t nextPoll = 0;
+	bool first = true;
 
-/**
- * Checks if the flash is busy with an internal operation.
- *
- * We have no real good way to report error from this function, so if an error
- * occurs, we break into the debugger and return false.
- */
-bool spiflash_is_busy(void) {
-	int err;
-	uint8_t temp;
-
-	// read first byte of the status register
+	// send the read status command; the status is then output continuously
 	uint8_t command[1] = {0x05};
 
+	systick_start();
 	spi_begin();
-	err = spiflash_command(&command, sizeof(command), &temp, sizeof(temp));
-	spi_end();
 
-	if(err < kErrSuccess) {
-#ifdef DEBUG
-		asm volatile ("bkpt 0");
-#endif
-		return false;
-	}
+	err = spiflash_command(&command, sizeof(command), NULL, 0);
 
-	// return busy flag
-	return (temp & 0x01);
-}
+	while(err >= kErrSuccess) {
+		// sample the busy flag if it's time to do so
+		if(elapsed >= nextPoll) {
+			uint8_t status;
+			err = spi_burst(NULL, &status, sizeof(status));
 
+			if(err >= kErrSuccess && !(status & 0x01)) {
+				gPendingOp = kSpiFlashOpNone;
+				break;
+			}
 
+			nextPoll = first ? timing->initialDelay : (elapsed + timing->pollInterval);
+			first = false;
+		}
 
-/**
- * Waits until the flash is no longer busy.
- */
-void spiflash_wait_for_idle(void) {
-	bool busy;
+		// count milliseconds and check for timeout
+		if(systick_elapsed() && ++elapsed >= timing->timeout) {
+			err = kErrTimeout;
+		}
+	}
 
-	// check the status register, waiting if it's still busy
-	do {
-		// read the status register
-		busy = spiflash_is_busy();
+	spi_end();
+	systick_stop();
 
-		// waste a little time if flash is still busy
-		if(busy) {
-			for(volatile int x = 0; x < 100000; x++) {}
-		}
-	} while(busy);
+	return err;
 }
 
 
@@ -400,3 +855,20 @@ int spiflash_write_disable(void) {
 	// return the error code of the command routine
 	return err;
 }
+
+
+
+/**
+ * Checks whether a buffer in memory contains only 0xFF bytes.
+ */
+bool spiflash_buffer_is_blank(const void *buf, size_t nBytes) {
+	const uint8_t *data = (const uint8_t *) buf;
+
+	for(size_t i = 0; i < nBytes; i++) {
+		if(data[i] != 0xFF) {
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -11,11 +11,32 @@
 #ifndef SPI_FLASH_H_
 #define SPI_FLASH_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+/// size of the flash, in bytes
+#define SPIFLASH_SIZE				0x80000
+
+#ifdef SPIFLASH_UPDATE
+/**
+ * Statistics returned by spiflash_update(), in units of 4K sectors.
+ */
+typedef struct {
+	/// sectors that already contained the new data
+	uint16_t skipped;
+	/// sectors that were programmed in place, without erasing
+	uint16_t programmed;
+	/// sectors that had to be erased before programming
+	uint16_t erased;
+} spiflash_update_stats_t;
+#endif
+
+
+
 /**
- * Initializes the SPI flash: reads vendor info.
+ * Initializes the SPI flash. If SPIFLASH_CALIBRATE_CLOCK is defined, this also
+ * selects the fastest SPI clock at which the flash can be read reliably.
  */
 void spiflash_init(void);
 
@@ -23,12 +44,28 @@ void spiflash_init(void);
  * Reads n bytes from the flash, starting at the specified address.
  */
 int spiflash_read(size_t nBytes, void *buf, uint32_t address);
+/**
+ * Starts reading n bytes from the flash into the buffer in the background. The
+ * read must be completed with spiflash_read_finish() before any other flash
+ * access; the buffer must not be accessed until then.
+ */
+int spiflash_read_start(size_t nBytes, void *buf, uint32_t address);
+/**
+ * Waits for a read started with spiflash_read_start() to complete.
+ */
+void spiflash_read_finish(void);
 /**
  * Reads n bytes from the flash's security register. The register is specified
- * by bits 9-8 of the address.
+ * by bits 13-12 of the address.
  */
 int spiflash_read_security(size_t nBytes, void *buf, uint32_t address);
 
+/**
+ * Checks whether n bytes starting at the specified address are all erased
+ * (0xFF.)
+ */
+int spiflash_is_blank(size_t nBytes, uint32_t address, bool *blank);
+
 /**
  * Writes n bytes to the flash, starting at the specified address. The pages
  * attempted to be programmed must have been erased previously.
@@ -40,15 +77,34 @@ int spiflash_read_security(size_t nBytes, void *buf, uint32_t address);
  * page are written, writing wraps to the start of the page.
  */
 int spiflash_write(size_t nBytes, void *buf, uint32_t address);
+/**
+ * Programs n bytes starting at the specified address, splitting the data at
+ * page boundaries. The pages must have been erased previously.
+ */
+int spiflash_program_range(size_t nBytes, void *buf, uint32_t address);
 /**
  * Writes n (at most 256) bytes to the address in the security register space of
  * the flash.
  */
 int spiflash_write_security(size_t nBytes, void *buf, uint32_t address);
 
+#ifdef SPIFLASH_UPDATE
+/**
+ * Updates n bytes (a multiple of 4K) starting at the specified (4K aligned)
+ * address with the given data, erasing and programming only where the contents
+ * differ. Statistics are written to stats, if specified. Only available if
+ * SPIFLASH_UPDATE is defined.
+ */
+int spiflash_update(size_t nBytes, void *buf, uint32_t address, spiflash_update_stats_t *stats);
+#endif
+
 /**
  * Erases n bytes starting at the specified address, in the most efficient way
  * possible.
+ *
+ * @note The range is rounded out to 4K block boundaries, so partial blocks at
+ * either end are erased entirely. Ranges that extend past the end of the flash
+ * are rejected.
  */
 int spiflash_erase(size_t nBytes, uint32_t address);
 /**
@@ -15,12 +15,40 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+/**
+ * Internal operations the flash may be busy with; this determines how the
+ * status register is polled while waiting for the operation to complete.
+ */
+typedef enum {
+	/// the flash is known to be idle
+	kSpiFlashOpNone				= 0,
+	/// the flash may be busy with an unknown operation (e.g. after reset)
+	kSpiFlashOpUnknown			= 1,
+	/// page program
+	kSpiFlashOpProgram			= 2,
+	/// 4K block erase
+	kSpiFlashOpErase4K			= 3,
+	/// 32K block erase
+	kSpiFlashOpErase32K			= 4,
+	/// 64K block erase
+	kSpiFlashOpErase64K			= 5,
+	/// security register erase
+	kSpiFlashOpEraseSecurity	= 6,
+} spiflash_op_t;
+
 /**
  * Reads n bytes from the flash, starting at the specified address. The specific
  * read command byte to use is specified.
  */
 int spiflash_read_internal(uint8_t command, size_t nBytes, void *buf, uint32_t address);
 
+/**
+ * Begins a read transaction: once the flash is idle, /CS is asserted and the
+ * read command with the given address (and a dummy byte) is sent. Data can
+ * then be clocked out until the transaction is ended with spi_end().
+ */
+int spiflash_begin_read(uint8_t command, uint32_t address);
+
 /**
  * Writes n bytes to the flash, starting at the specified address. The pages
  * attempted to be programmed must have been erased previously. This will write
@@ -38,26 +66,39 @@ int spiflash_erase_block_internal(uint8_t command, uint32_t address);
 
 
 /**
- * Writes a command to the chip, then reads zero or more bytes of response.
+ * Reads the three byte JEDEC manufacturer/device ID.
  */
-int spiflash_command(void *command, size_t commandLen, void *response, size_t responseLen);
+int spiflash_read_id(uint8_t *id);
+
+#ifdef SPIFLASH_CALIBRATE_CLOCK
+/**
+ * Reads the JEDEC ID several times at the current clock and checks whether it
+ * matches the given reference each time.
+ */
+bool spiflash_verify_id(const uint8_t *reference);
+#endif
 
 
 
 /**
- * Checks if the flash is busy with an internal operation.
+ * Writes a command to the chip, then reads zero or more bytes of response.
  */
-bool spiflash_is_busy(void);
+int spiflash_command(void *command, size_t commandLen, void *response, size_t responseLen);
+
+
 
 /**
- * Waits until the flash is no longer busy.
+ * Waits until the flash has completed the last operation started, or until
+ * the timeout for that type of operation expires.
  */
-void spiflash_wait_for_idle(void);
+int spiflash_wait_for_idle(void);
+
+
 
 /**
- * Reads out the status register.
+ * Checks whether a buffer in memory contains only 0xFF bytes.
  */
-int spiflash_get_status(uint16_t *status);
+bool spiflash_buffer_is_blank(const void *buf, size_t nBytes);
 
 
 
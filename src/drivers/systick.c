@@ -0,0 +1,41 @@
+/*
+ * systick.c
+ */
+#include "systick.h"
+
+#include "stm32f0xx.h"
+
+#include <stdint.h>
+
+/**
+ * Starts the SysTick timer with a period of 1 ms.
+ *
+ * The reload value is derived from the actual HCLK: if the HSE fails to start,
+ * SystemInit() leaves the core running from the 8 MHz HSI.
+ */
+void systick_start(void) {
+	SystemCoreClockUpdate();
+
+	SysTick->LOAD = (SystemCoreClock / 1000) - 1;
+	SysTick->VAL = 0;
+
+	// clock from HCLK, no interrupt
+	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+/**
+ * Stops the SysTick timer.
+ */
+void systick_stop(void) {
+	SysTick->CTRL = 0;
+}
+
+/**
+ * Returns true if a millisecond has elapsed since the last call. This must be
+ * called at least once per millisecond, or ticks are lost.
+ *
+ * Reading CTRL clears the COUNTFLAG bit.
+ */
+bool systick_elapsed(void) {
+	return (SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk);
+}
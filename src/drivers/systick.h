@@ -0,0 +1,29 @@
+/*
+ * systick.h
+ *
+ * Provides a simple millisecond time base using the SysTick timer, without
+ * interrupts: callers poll for elapsed milliseconds instead.
+ */
+
+#ifndef SYSTICK_H_
+#define SYSTICK_H_
+
+#include <stdbool.h>
+
+/**
+ * Starts the SysTick timer with a period of 1 ms.
+ */
+void systick_start(void);
+
+/**
+ * Stops the SysTick timer.
+ */
+void systick_stop(void);
+
+/**
+ * Returns true if a millisecond has elapsed since the last call. This must be
+ * called at least once per millisecond, or ticks are lost.
+ */
+bool systick_elapsed(void);
+
+#endif /* SYSTICK_H_ */
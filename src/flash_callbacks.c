@@ -0,0 +1,72 @@
+/*
+ * flash_callbacks.c
+ *
+ * Implements the flash callbacks on top of the SPI flash driver, so code that
+ * is shared with applications can also be used by the loader itself.
+ */
+#include "flash_callbacks.h"
+
+#include "drivers/spi_flash.h"
+#include "drivers/errors.h"
+
+/**
+ * The driver is always ready to use.
+ */
+static int flash_callbacks_open(void) {
+	return kErrSuccess;
+}
+
+/**
+ * Reads from the flash.
+ */
+static int flash_callbacks_read(uint32_t address, size_t nBytes, void *buf) {
+	return spiflash_read(nBytes, buf, address);
+}
+
+/**
+ * Erases an area of flash.
+ */
+static int flash_callbacks_erase(uint32_t address, size_t nBytes) {
+	return spiflash_erase(nBytes, address);
+}
+
+/**
+ * Programs previously erased flash.
+ */
+static int flash_callbacks_write(uint32_t address, size_t nBytes, void *buf) {
+	return spiflash_program_range(nBytes, buf, address);
+}
+
+/**
+ * Reads from the security registers.
+ */
+static int flash_callbacks_read_security(uint32_t address, size_t nBytes, void *buf) {
+	return spiflash_read_security(nBytes, buf, address);
+}
+
+/**
+ * Erases a security register.
+ */
+static int flash_callbacks_erase_security(uint32_t address) {
+	return spiflash_erase_security(address);
+}
+
+/**
+ * Programs a previously erased security register.
+ */
+static int flash_callbacks_write_security(uint32_t address, size_t nBytes, void *buf) {
+	return spiflash_write_security(nBytes, buf, address);
+}
+
+const bootloader_flash_callbacks_t kSpiFlashCallbacks = {
+	.flash_open = flash_callbacks_open,
+	.flash_close = flash_callbacks_open,
+
+	.flash_read = flash_callbacks_read,
+	.flash_erase = flash_callbacks_erase,
+	.flash_write = flash_callbacks_write,
+
+	.flash_read_security = flash_callbacks_read_security,
+	.flash_erase_security = flash_callbacks_erase_security,
+	.flash_write_security = flash_callbacks_write_security,
+};
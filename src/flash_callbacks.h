@@ -0,0 +1,16 @@
+/*
+ * flash_callbacks.h
+ *
+ * Flash callbacks, as used by applications calling into the loader, that are
+ * implemented by the loader's own SPI flash driver.
+ */
+
+#ifndef FLASH_CALLBACKS_H_
+#define FLASH_CALLBACKS_H_
+
+#include "bootloader.h"
+
+/// callbacks for the loader's SPI flash driver
+extern const bootloader_flash_callbacks_t kSpiFlashCallbacks;
+
+#endif /* FLASH_CALLBACKS_H_ */
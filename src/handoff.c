@@ -0,0 +1,91 @@
+/*
+ * handoff.c
+ *
+ * The snapshot is protected by a CRC, since it's not there after a power cycle
+ * or when the firmware was booted without reading the journal; it is then read
+ * again, through the application's flash callbacks.
+ */
+#include "handoff.h"
+
+#include "bootloader.h"
+#include "crc32.h"
+
+#include "drivers/errors.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * Layout of the handoff area, as used by the loader.
+ */
+typedef struct {
+	/// BOOTLOADER_UPDATE_MAGIC if an update was requested
+	uint32_t request;
+
+	/// incremented each time the snapshot is stored
+	uint32_t generation;
+	/// journal state
+	journal_t journal;
+
+	/// CRC of the generation and journal state
+	uint32_t crc32;
+} handoff_t;
+
+_Static_assert(sizeof(handoff_t) <= sizeof(bootloader_handoff_t), "handoff area too small");
+
+/// the handoff area
+static handoff_t * const kHandoff = (handoff_t *) BOOTLOADER_HANDOFF_ADDRESS;
+
+
+
+/**
+ * Returns the CRC of the snapshot.
+ */
+static uint32_t handoff_crc(void) {
+	return crc32_update(0, &kHandoff->generation, offsetof(handoff_t, crc32) - offsetof(handoff_t, generation));
+}
+
+/**
+ * Invalidates the snapshot.
+ */
+void handoff_invalidate(void) {
+	kHandoff->crc32 = ~handoff_crc();
+}
+
+/**
+ * Stores a snapshot of the journal state, and increments its generation.
+ */
+void handoff_store(const journal_t *journal) {
+	if(kHandoff->crc32 != handoff_crc()) {
+		kHandoff->generation = 0;
+	}
+
+	// it's returned as a positive int
+	kHandoff->generation = (kHandoff->generation + 1) & 0x7FFFFFFF;
+	memcpy(&kHandoff->journal, journal, sizeof(journal_t));
+
+	kHandoff->crc32 = handoff_crc();
+}
+
+/**
+ * Gets the journal state from the snapshot; if there is no valid snapshot, the
+ * journal is read through the given callbacks instead, and stored. Returns the
+ * generation of the snapshot.
+ */
+int handoff_load(const bootloader_flash_callbacks_t *flash, journal_t *journal) {
+	int err;
+
+	if(kHandoff->crc32 != handoff_crc()) {
+		err = journal_load(flash, journal);
+
+		if(err < kErrSuccess) {
+			return err;
+		}
+
+		handoff_store(journal);
+	} else {
+		memcpy(journal, &kHandoff->journal, sizeof(journal_t));
+	}
+
+	return kHandoff->generation;
+}
@@ -0,0 +1,30 @@
+/*
+ * handoff.h
+ *
+ * Keeps a snapshot of the boot state in the handoff area in RAM, so that
+ * applications can read and update it without reading the journal again.
+ */
+
+#ifndef HANDOFF_H_
+#define HANDOFF_H_
+
+#include "journal.h"
+
+/**
+ * Invalidates the snapshot.
+ */
+void handoff_invalidate(void);
+
+/**
+ * Stores a snapshot of the journal state, and increments its generation.
+ */
+void handoff_store(const journal_t *journal);
+
+/**
+ * Gets the journal state from the snapshot; if there is no valid snapshot, the
+ * journal is read through the given callbacks instead, and stored. Returns the
+ * generation of the snapshot.
+ */
+int handoff_load(const bootloader_flash_callbacks_t *flash, journal_t *journal);
+
+#endif /* HANDOFF_H_ */
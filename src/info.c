@@ -9,6 +9,8 @@
 #include "bootloader.h"
 
 #include "loader_api.h"
+#include "crc32.h"
+#include "bootstate.h"
 
 #include <stddef.h>
 #include <stdint.h>
@@ -17,10 +19,14 @@
  * Bootloader information block, located towards the end of flash.
  */
 __attribute__ ((section(".loaderinfo"),used)) const bootloader_interface_t kLoaderInfo = {
-	.version = 0x0010,
+	.version = 0x0020,
 
 	.mark_fw_good = loader_mark_fw_good,
 	.read_loader_info = loader_read_info,
+
+	.crc32_update = crc32_update,
+
+	.invalidate_fast_boot = bootstate_invalidate,
 };
 
 
@@ -0,0 +1,440 @@
+/*
+ * journal.c
+ *
+ * The journal occupies two sectors, of which one is active at a time. Each
+ * sector starts with a header, holding a sequence number (the active sector is
+ * the one with the higher number) and the CRC of the info block the journal was
+ * started for; if the info block is rewritten, the journal no longer applies.
+ *
+ * Records follow the header, and are appended until the sector is full. The
+ * state is then compacted into the other sector: it is erased, and a snapshot
+ * record holding the entire state is written, followed by the header. Since
+ * the header is written last, an interrupted compaction leaves the previous
+ * sector active.
+ *
+ * Each record carries the complement of its type and slot, so partially
+ * programmed records are detected and skipped.
+ *
+ * If the info block doesn't match its CRC, the state is taken from the
+ * snapshot at the start of the newest journal sector instead, whatever info
+ * block it was started for.
+ *
+ * The state is always kept in the version 2 layout. An info block in the
+ * version 1 layout is only converted if JOURNAL_INFO_V1 is defined; the loader
+ * leaves this out by default, to save flash.
+ */
+#include "journal.h"
+
+#include "crc32.h"
+
+#include "drivers/errors.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/// number of bytes read at a time when scanning the journal; this must hold a
+/// snapshot record
+#define JOURNAL_READ_SIZE		128
+/// size of the state in a snapshot record, rounded up to whole records
+#define JOURNAL_SNAPSHOT_SIZE	((sizeof(bootloader_info_t) + 3) & ~3)
+
+/**
+ * Header at the start of each journal sector.
+ */
+typedef struct {
+	/// sequence number, and its complement
+	uint16_t sequence;
+	uint16_t sequenceCheck;
+
+	/// CRC of the info block the journal applies to
+	uint32_t baseCrc;
+} journal_header_t;
+
+/**
+ * Data read from the journal while scanning it.
+ */
+typedef struct {
+	uint32_t data[JOURNAL_READ_SIZE / 4];
+
+	/// address of the data, and number of bytes read
+	uint32_t address;
+	size_t len;
+} journal_buffer_t;
+
+/**
+ * A journal record.
+ */
+typedef struct {
+	/// type of record
+	uint8_t type;
+	/// firmware slot it applies to
+	uint8_t slot;
+
+	/// complements of type and slot
+	uint8_t typeCheck;
+	uint8_t slotCheck;
+} journal_record_t;
+
+/**
+ * Returns the CRC of the info structure, not including its CRC field.
+ */
+static uint32_t journal_info_crc(const bootloader_info_t *info) {
+	return crc32_update(0, info, offsetof(bootloader_info_t, crc32));
+}
+
+/**
+ * Applies a record to the state.
+ */
+static void journal_apply(journal_t *journal, const journal_record_t *record) {
+	bootloader_info_t *info = &journal->info;
+
+	if(record->slot >= 8) {
+		return;
+	}
+
+	switch(record->type) {
+		case kJournalBoot:
+			if(info->fwInfo[record->slot].startFails != 0xFF) {
+				info->fwInfo[record->slot].startFails++;
+			}
+			break;
+
+		case kJournalGood:
+			info->fwInfo[record->slot].startFails = 0;
+
+			if(info->fwInfo[record->slot].startSuccesses != 0xFF) {
+				info->fwInfo[record->slot].startSuccesses++;
+			}
+
+			journal->pendingResets |= (1 << record->slot);
+			break;
+
+		case kJournalCounterReset:
+			journal->pendingResets &= ~(1 << record->slot);
+			break;
+
+		case kJournalSelect:
+			info->currentFirmware = record->slot;
+			break;
+	}
+}
+
+/**
+ * Makes sure the n bytes at the given address are in the buffer. If they're
+ * not, as much as fits (up to the end address) is read, starting there.
+ */
+static int journal_fill(const bootloader_flash_callbacks_t *flash, journal_buffer_t *buf, uint32_t address, size_t nBytes, uint32_t end) {
+	if(address >= buf->address && (address + nBytes) <= (buf->address + buf->len)) {
+		return kErrSuccess;
+	}
+
+	buf->address = address;
+	buf->len = (JOURNAL_READ_SIZE > (end - address)) ? (end - address) : JOURNAL_READ_SIZE;
+
+	return flash->flash_read(buf->address, buf->len, buf->data);
+}
+
+/**
+ * Reads the records in the active sector, and applies them to the state. This
+ * also finds the first free record.
+ */
+static int journal_scan(const bootloader_flash_callbacks_t *flash, journal_t *journal) {
+	int err;
+
+	uint32_t address = journal->sector + sizeof(journal_header_t);
+	uint32_t end = journal->sector + BOOTLOADER_JOURNAL_SECTOR_SIZE;
+
+	// the records are read in chunks
+	journal_buffer_t buf;
+	buf.len = 0;
+
+	while((address + sizeof(journal_record_t)) <= end) {
+		err = journal_fill(flash, &buf, address, sizeof(journal_record_t), end);
+
+		if(err < kErrSuccess) {
+			return err;
+		}
+
+		journal_record_t record;
+		memcpy(&record, ((const uint8_t *) buf.data) + (address - buf.address), sizeof(record));
+
+		// stop at the first free record
+		if(record.type == kJournalFree && record.slot == 0xFF &&
+				record.typeCheck == 0xFF && record.slotCheck == 0xFF) {
+			break;
+		}
+
+		address += sizeof(record);
+
+		// skip partially programmed records
+		if((record.type ^ record.typeCheck) != 0xFF || (record.slot ^ record.slotCheck) != 0xFF) {
+			continue;
+		}
+
+		if(record.type == kJournalSnapshot) {
+			// the state follows the record; it's only read if it's complete
+			if(JOURNAL_SNAPSHOT_SIZE > (end - address)) {
+				address = end;
+				break;
+			}
+
+			err = journal_fill(flash, &buf, address, JOURNAL_SNAPSHOT_SIZE, end);
+
+			if(err < kErrSuccess) {
+				return err;
+			}
+
+			bootloader_info_t info;
+			memcpy(&info, ((const uint8_t *) buf.data) + (address - buf.address), sizeof(info));
+
+			if(journal_info_crc(&info) == info.crc32) {
+				memcpy(&journal->info, &info, sizeof(info));
+				journal->pendingResets = record.slot;
+			}
+
+			address += JOURNAL_SNAPSHOT_SIZE;
+		} else {
+			journal_apply(journal, &record);
+		}
+	}
+
+	journal->next = address;
+
+	return kErrSuccess;
+}
+
+#ifdef JOURNAL_INFO_V1
+/**
+ * Converts an info block in the version 1 layout to the current one.
+ */
+static void journal_convert_v1(const bootloader_info_v1_t *v1, bootloader_info_t *info) {
+	memset(info, 0xFF, sizeof(bootloader_info_t));
+
+	info->header = BOOTLOADER_INFO_HEADER;
+	info->totalFirmwares = v1->totalFirmwares;
+	info->currentFirmware = v1->currentFirmware;
+	info->failsafeFirmware = v1->failsafeFirmware;
+
+	for(int i = 0; i < 8; i++) {
+		info->fwInfo[i].version = v1->fwInfo[i].version;
+		info->fwInfo[i].startFails = v1->fwInfo[i].startFails;
+		info->fwInfo[i].startSuccesses = v1->fwInfo[i].startSuccesses;
+	}
+}
+#endif
+
+/**
+ * Reads the info block, finds the active sector and applies its records. The
+ * flash must be open.
+ *
+ * If the info block is corrupt (or in the version 1 layout, without support
+ * for it) the newest sector is used regardless of the info block it was
+ * started for, and it must begin with a valid snapshot.
+ */
+static int journal_read(const bootloader_flash_callbacks_t *flash, journal_t *journal) {
+	int err;
+	const uint32_t layout = BOOTLOADER_INFO_HEADER;
+
+	// read the info block, in either layout
+	union {
+		bootloader_info_t v2;
+#ifdef JOURNAL_INFO_V1
+		bootloader_info_v1_t v1;
+#endif
+	} block;
+
+	err = flash->flash_read(BOOTLOADER_INFO_ADDRESS, sizeof(block.v2), &block);
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	size_t blockLen = sizeof(block.v2);
+	bool valid = false;
+
+	if(block.v2.header == BOOTLOADER_INFO_HEADER) {
+		memcpy(&journal->info, &block.v2, sizeof(block.v2));
+		valid = (journal_info_crc(&block.v2) == block.v2.crc32);
+	} else {
+#ifdef JOURNAL_INFO_V1
+		journal_convert_v1(&block.v1, &journal->info);
+		blockLen = sizeof(block.v1);
+		valid = (crc32_update(0, &block.v1, offsetof(bootloader_info_v1_t, crc32)) == block.v1.crc32);
+#endif
+	}
+
+	// the state layout is part of the CRC, so journals whose snapshots are in
+	// the version 1 layout are ignored
+	journal->baseCrc = crc32_update(crc32_update(0, &block, blockLen), &layout, sizeof(layout));
+
+	// without an info block, the state must come from a snapshot
+	if(!valid) {
+		journal->info.header = 0;
+	}
+
+	// find the active sector
+	for(int i = 0; i < 2; i++) {
+		uint32_t sector = BOOTLOADER_JOURNAL_ADDRESS + (i * BOOTLOADER_JOURNAL_SECTOR_SIZE);
+
+		journal_header_t header;
+		err = flash->flash_read(sector, sizeof(header), &header);
+
+		if(err < kErrSuccess) {
+			return err;
+		}
+
+		if((header.sequence ^ header.sequenceCheck) != 0xFFFF || (valid && header.baseCrc != journal->baseCrc)) {
+			continue;
+		}
+
+		if(journal->sector == 0 || (int16_t) (header.sequence - journal->sequence) > 0) {
+			journal->sector = sector;
+			journal->sequence = header.sequence;
+
+			if(!valid) {
+				journal->baseCrc = header.baseCrc;
+			}
+		}
+	}
+
+	// apply its records
+	if(journal->sector != 0) {
+		err = journal_scan(flash, journal);
+
+		if(err < kErrSuccess) {
+			return err;
+		}
+	}
+
+	// records don't touch the header, so it's only set if a snapshot was read
+	if(journal->info.header != BOOTLOADER_INFO_HEADER) {
+		return kErrBootStateCorrupt;
+	}
+
+	return kErrSuccess;
+}
+
+/**
+ * Reads the info block, and applies all records in the journal to it.
+ */
+int journal_load(const bootloader_flash_callbacks_t *flash, journal_t *journal) {
+	int err;
+
+	memset(journal, 0, sizeof(journal_t));
+
+	err = flash->flash_open();
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	err = journal_read(flash, journal);
+
+	flash->flash_close();
+
+	return err;
+}
+
+
+
+/**
+ * Compacts the state into the inactive sector (or the first sector, if there
+ * is no journal yet) and makes it the active one.
+ */
+static int journal_compact(const bootloader_flash_callbacks_t *flash, journal_t *journal) {
+	int err;
+
+	uint32_t sector = BOOTLOADER_JOURNAL_ADDRESS;
+
+	if(journal->sector == BOOTLOADER_JOURNAL_ADDRESS) {
+		sector += BOOTLOADER_JOURNAL_SECTOR_SIZE;
+	}
+
+	err = flash->flash_erase(sector, BOOTLOADER_JOURNAL_SECTOR_SIZE);
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	// write the snapshot
+	uint32_t snapshot[(sizeof(journal_record_t) + JOURNAL_SNAPSHOT_SIZE) / 4];
+	memset(snapshot, 0xFF, sizeof(snapshot));
+
+	journal_record_t record = {
+		.type = kJournalSnapshot,
+		.slot = journal->pendingResets,
+		.typeCheck = kJournalSnapshot ^ 0xFF,
+		.slotCheck = journal->pendingResets ^ 0xFF
+	};
+
+	journal->info.crc32 = journal_info_crc(&journal->info);
+
+	memcpy(snapshot, &record, sizeof(record));
+	memcpy(((uint8_t *) snapshot) + sizeof(record), &journal->info, sizeof(journal->info));
+
+	err = flash->flash_write(sector + sizeof(journal_header_t), sizeof(snapshot), snapshot);
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	// then activate the sector
+	journal_header_t header = {
+		.sequence = journal->sequence + 1,
+		.sequenceCheck = (journal->sequence + 1) ^ 0xFFFF,
+		.baseCrc = journal->baseCrc
+	};
+
+	err = flash->flash_write(sector, sizeof(header), &header);
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	journal->sector = sector;
+	journal->sequence = header.sequence;
+	journal->next = sector + sizeof(header) + sizeof(snapshot);
+
+	return kErrSuccess;
+}
+
+/**
+ * Appends a record to the journal, and applies it to the state. If the active
+ * sector is full, it's compacted first.
+ */
+int journal_append(const bootloader_flash_callbacks_t *flash, journal_t *journal, uint8_t type, uint8_t slot) {
+	int err;
+
+	journal_record_t record = {
+		.type = type,
+		.slot = slot,
+		.typeCheck = type ^ 0xFF,
+		.slotCheck = slot ^ 0xFF
+	};
+
+	err = flash->flash_open();
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	// make room for the record, then write it
+	if(journal->sector == 0 ||
+			(journal->next + sizeof(record)) > (journal->sector + BOOTLOADER_JOURNAL_SECTOR_SIZE)) {
+		err = journal_compact(flash, journal);
+	}
+
+	if(err >= kErrSuccess) {
+		err = flash->flash_write(journal->next, sizeof(record), &record);
+	}
+
+	if(err >= kErrSuccess) {
+		journal->next += sizeof(record);
+		journal_apply(journal, &record);
+	}
+
+	flash->flash_close();
+
+	return err;
+}
@@ -0,0 +1,69 @@
+/*
+ * journal.h
+ *
+ * Keeps the boot state as an append-only log of small records in the SPI
+ * flash, applied on top of the info block. Recording an event then takes a
+ * single small page program, rather than erasing and rewriting the info block.
+ *
+ * The journal works through flash callbacks, so it can be used by the loader
+ * as well as by applications calling into it.
+ */
+
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include "bootloader.h"
+
+#include <stdint.h>
+
+/**
+ * Types of journal records.
+ */
+enum {
+	/// a boot of the slot was attempted; its start failures are incremented
+	/// (the loader counts these in the security register instead)
+	kJournalBoot				= 0x01,
+	/// the slot booted successfully; start failures are cleared and start
+	/// successes incremented, and its start failure counter must be reset
+	kJournalGood				= 0x02,
+	/// the slot becomes the current firmware
+	kJournalSelect				= 0x03,
+	/// the slot's start failure counter has been reset
+	kJournalCounterReset		= 0x04,
+
+	/// a copy of the entire state follows the record; the slot field holds
+	/// the pending counter resets
+	kJournalSnapshot			= 0x10,
+	/// unused space
+	kJournalFree				= 0xFF,
+};
+
+/**
+ * State of the journal, as rebuilt from flash.
+ */
+typedef struct {
+	/// boot state, with all records applied
+	bootloader_info_t info;
+	/// slots (one bit each) whose start failure counter must be reset
+	uint8_t pendingResets;
+
+	/// address of the active sector (0 if there is none), and of the next free
+	/// record in it
+	uint32_t sector, next;
+	/// sequence number of the active sector
+	uint16_t sequence;
+	/// CRC of the info block the journal applies to
+	uint32_t baseCrc;
+} journal_t;
+
+/**
+ * Reads the info block, and applies all records in the journal to it.
+ */
+int journal_load(const bootloader_flash_callbacks_t *flash, journal_t *journal);
+
+/**
+ * Appends a record to the journal, and applies it to the state.
+ */
+int journal_append(const bootloader_flash_callbacks_t *flash, journal_t *journal, uint8_t type, uint8_t slot);
+
+#endif /* JOURNAL_H_ */
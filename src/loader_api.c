@@ -1,25 +1,70 @@
 /*
  * loader_api.c
  *
+ * Both calls work from the snapshot of the boot state that the loader leaves
+ * in RAM, so they normally don't read the SPI flash at all.
+ *
  *  Created on: Nov 9, 2018
  *      Author: tristan
  */
 #include "loader_api.h"
 
-#include "drivers/spi_flash.h"
+#include "bootstate.h"
+#include "handoff.h"
+#include "journal.h"
+
+#include "drivers/errors.h"
+
+#include <string.h>
 
 /**
- * Marks the currently booted version of the firmware as good.
+ * Marks the currently booted version of the firmware as good. This appends a
+ * single record to the journal, unless its sector needs to be compacted.
+ *
+ * If the firmware was booted directly, it's already recorded as good, so
+ * nothing is done: there is no snapshot to work from after a direct boot, and
+ * reading the journal for it would make every boot pay for a full scan.
  */
 int loader_mark_fw_good(bootloader_flash_callbacks_t *callbacks) {
-	return -1;
+	int err;
+	journal_t journal;
+
+	if(bootstate_is_valid()) {
+		return kErrSuccess;
+	}
+
+	err = handoff_load(callbacks, &journal);
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	err = journal_append(callbacks, &journal, kJournalGood, journal.info.currentFirmware);
+
+	// the journal may have been compacted even if the write failed
+	if(err < kErrSuccess) {
+		handoff_invalidate();
+		return err;
+	}
+
+	handoff_store(&journal);
+	return kErrSuccess;
 }
 
 
 
 /**
- * Reads the loader information block from flash.
+ * Reads the boot state, and returns its generation.
  */
 int loader_read_info(bootloader_flash_callbacks_t *callbacks, bootloader_info_t *info) {
-	return -1;
+	int generation;
+	journal_t journal;
+
+	generation = handoff_load(callbacks, &journal);
+
+	if(generation >= kErrSuccess) {
+		memcpy(info, &journal.info, sizeof(bootloader_info_t));
+	}
+
+	return generation;
 }
@@ -11,12 +11,14 @@
 #include "bootloader.h"
 
 /**
- * Marks the currently booted version of the firmware as good.
+ * Marks the currently booted version of the firmware as good. This appends a
+ * single record to the journal, unless its sector needs to be compacted.
  */
 int loader_mark_fw_good(bootloader_flash_callbacks_t *callbacks);
 
 /**
- * Reads the loader information block from flash.
+ * Reads the boot state, and returns its generation. This is normally served
+ * from the snapshot in RAM, without any flash access.
  */
 int loader_read_info(bootloader_flash_callbacks_t *callbacks, bootloader_info_t *info);
 
@@ -1,20 +1,24 @@
 #include "stm32f0xx.h"
 
+#include "bootloader.h"
+#include "bootstate.h"
+#include "counters.h"
+#include "flash_callbacks.h"
+#include "handoff.h"
+#include "journal.h"
+#include "upgrade.h"
+
 #include "drivers/spi.h"
+#include "drivers/spi_flash.h"
+#include "drivers/errors.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /**
- * Bootloader entry point. This does several things:
- *
- * - Reads the loader information page out of the SPI flash.
- * - Upgrades the firmware currently loaded into on-board flash.
- * - Jumps to the firmware in flash.
+ * Jumps to the firmware in flash.
  */
-__attribute__((noreturn)) void main(void) {
-	// initialize the SPI driver
-	spi_init();
-
+__attribute__((noreturn)) static void main_boot(void) {
 	// disable all peripherals
 	RCC->AHBENR = 0;
 	RCC->APB2ENR = 0;
@@ -35,3 +39,118 @@ __attribute__((noreturn)) void main(void) {
     // we literally cannot get back here
     while(1) {}
 }
+
+
+/**
+ * Checks whether a complete image is installed: the version block's CRC is
+ * cleared when an install starts and only written once it's complete, and an
+ * erased application region has no initial stack pointer. The CRC is also
+ * rejected if it's erased, in case the install was interrupted after erasing
+ * the version block's page.
+ */
+static bool main_image_is_valid(void) {
+	const bootloader_version_t *installed = (const bootloader_version_t *) BOOTLOADER_VERSION_ADDRESS;
+	const uint32_t *appVectors = (const uint32_t *) BOOTLOADER_APP_ADDRESS;
+
+	return (installed->crc32 != 0) && (installed->crc32 != 0xFFFFFFFF) &&
+			(appVectors[0] != 0xFFFFFFFF);
+}
+
+
+
+/**
+ * Called by the startup code before anything else. Unless an update was
+ * requested, boots firmware that's known to be good right away: clocks are not
+ * set up, and RAM is not initialized.
+ */
+void __initialize_hardware_early(void) {
+	const volatile bootloader_handoff_t *handoff = (const volatile bootloader_handoff_t *) BOOTLOADER_HANDOFF_ADDRESS;
+
+	if(handoff->request != BOOTLOADER_UPDATE_MAGIC && bootstate_is_valid()) {
+		main_boot();
+	}
+
+	SystemInit();
+}
+
+/**
+ * Bootloader entry point; this only runs if the firmware can't be booted
+ * directly. It does several things:
+ *
+ * - Reads the loader information page and boot state journal out of the SPI
+ *   flash.
+ * - Upgrades the firmware currently loaded into on-board flash. If that fails,
+ *   it's tried once more, then the failsafe firmware is installed instead.
+ * - Counts the boot attempt as a start failure, until the firmware marks
+ *   itself as good; if it was marked good and is still installed, the next
+ *   boots are direct.
+ * - Leaves a snapshot of the boot state in RAM for the firmware.
+ * - Jumps to the firmware in flash, unless no complete image is installed; in
+ *   that case, it stays in the loader.
+ */
+__attribute__((noreturn)) void main(void) {
+	int err;
+	volatile bootloader_handoff_t *handoff = (volatile bootloader_handoff_t *) BOOTLOADER_HANDOFF_ADDRESS;
+
+	// the firmware can't be booted directly until it's marked good again
+	bootstate_invalidate();
+	handoff->request = 0;
+
+	// the boot state may change, so the snapshot is taken again below
+	handoff_invalidate();
+
+	// initialize the SPI driver and flash
+	spi_init();
+	spiflash_init();
+
+	// read the boot state and install the current firmware if needed
+	journal_t journal;
+	err = journal_load(&kSpiFlashCallbacks, &journal);
+
+	if(err >= kErrSuccess && journal.info.currentFirmware < 8) {
+		const bootloader_version_t *installed = (const bootloader_version_t *) BOOTLOADER_VERSION_ADDRESS;
+		uint8_t slot = journal.info.currentFirmware;
+
+		// slots that were marked good since their last counted start
+		uint8_t good = journal.pendingResets;
+		uint32_t crc = installed->crc32;
+
+		counters_load(&kSpiFlashCallbacks, &journal);
+		int installErr = upgrade_install(slot);
+
+		// a failed install may have left a partial image: try it once more, then
+		// fall back to the failsafe firmware
+		if(installErr < kErrSuccess) {
+			installErr = upgrade_install(slot);
+		}
+
+		if(installErr < kErrSuccess && journal.info.failsafeFirmware < 8 &&
+				journal.info.failsafeFirmware != slot) {
+			slot = journal.info.failsafeFirmware;
+			installErr = upgrade_install(slot);
+
+			if(installErr >= kErrSuccess) {
+				journal_append(&kSpiFlashCallbacks, &journal, kJournalSelect, slot);
+			}
+		}
+
+		// unless it's still the same good firmware, this counts as a failed start
+		if(installErr >= kErrSuccess && (good & (1 << slot)) && installed->crc32 == crc) {
+			bootstate_write(slot);
+		} else {
+			counters_increment(&kSpiFlashCallbacks, &journal, slot);
+		}
+	}
+
+	// leave the boot state for the firmware
+	if(err >= kErrSuccess) {
+		handoff_store(&journal);
+	}
+
+	// never jump into a partially written image
+	if(!main_image_is_valid()) {
+		while(1) {}
+	}
+
+	main_boot();
+}
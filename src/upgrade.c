@@ -0,0 +1,858 @@
+/*
+ * upgrade.c
+ *
+ * The image is copied in chunks, using two buffers: while one chunk is being
+ * programmed into internal flash, the next one is read from the SPI flash by
+ * DMA. Pages of internal flash are erased as they are reached, or only if
+ * their contents differ in differential mode. The image's CRC is computed
+ * over each chunk while the next one is being read.
+ *
+ * Delta images are applied a page at a time: the page is assembled in RAM from
+ * the installed image and literal data, then programmed. Compressed images are
+ * decompressed into the same page buffer; references to earlier pages read
+ * them back from internal flash, where they have already been programmed.
+ *
+ * Support for delta and compressed images is only built if UPGRADE_DELTA and
+ * UPGRADE_LZ are defined, respectively: the loader doesn't have the flash to
+ * spare for them by default. For the same reason, copies that aren't
+ * differential (which the loader never makes) need UPGRADE_STREAM.
+ */
+#include "upgrade.h"
+
+#include "bootloader.h"
+
+#include "crc32.h"
+
+#include "drivers/flash.h"
+#include "drivers/spi_flash.h"
+#include "drivers/errors.h"
+
+#include <string.h>
+
+/// size of a chunk; pages are always a multiple of this
+#define UPGRADE_CHUNK_SIZE		512
+
+/// address of the installed image's CRC, in the version block
+#define UPGRADE_CRC_ADDRESS		(BOOTLOADER_VERSION_ADDRESS + offsetof(bootloader_version_t, crc32))
+
+/// buffers: only one of these is used at a time
+static union {
+	/// chunk buffers: one is programmed while the other is being read into
+	uint16_t chunks[2][UPGRADE_CHUNK_SIZE / 2];
+	/// a page of new data, or of delta or decompressed output being assembled
+	uint16_t page[FLASH_PAGE_SIZE / 2];
+} gBuffers;
+
+#ifdef UPGRADE_LZ
+/// size of the compressed data input buffer
+#define UPGRADE_LZ_INPUT_SIZE	64
+
+/// state of decompressing an image
+static struct {
+	/// next address to read compressed data from, and the end of the data
+	uint32_t address, end;
+	/// read position and number of bytes in the input buffer
+	uint16_t pos, len;
+	/// buffer of compressed data
+	uint8_t input[UPGRADE_LZ_INPUT_SIZE];
+
+	/// number of bytes output so far, and the total output length
+	uint32_t offset, length;
+	/// running CRC of the output
+	uint32_t crc;
+
+	/// statistics to update, if any
+	upgrade_stats_t *stats;
+} gLz;
+#endif
+
+/// state of copying an image
+static struct {
+	/// number of image bytes not yet included in the CRCs
+	uint32_t remaining;
+	/// CRC of the data read from the SPI flash, and of the programmed data
+	uint32_t crc, readbackCrc;
+
+	/// bytes read from the SPI flash so far, and read back from internal flash
+	uint32_t bytesRead, verifyBytes;
+} gCopy;
+
+#ifdef UPGRADE_STREAM
+/// processes a chunk of the image, corresponding to the given address
+typedef int (*upgrade_chunk_fn)(const void *chunk, size_t nBytes, uint32_t dest);
+#endif
+
+/**
+ * Installs the image in the given firmware slot, unless it is installed
+ * already.
+ *
+ * Whether the image is installed is determined by comparing the CRC in its
+ * header against the one in the version block, which is written once an image
+ * has been copied successfully. In the common case, this means only the header
+ * is read from the SPI flash, with a single read.
+ *
+ * Only the image data itself is copied; the rest of the application region is
+ * erased (which includes the version block, if the image doesn't reach it.)
+ */
+int upgrade_install(uint8_t slot) {
+	int err;
+
+	const bootloader_version_t *installed = (const bootloader_version_t *) BOOTLOADER_VERSION_ADDRESS;
+	uint32_t address = BOOTLOADER_SLOT_ADDRESS(slot);
+
+	// read the image header
+	bootloader_image_header_t header;
+	err = spiflash_read(sizeof(header), &header, address);
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	if(header.magic != BOOTLOADER_IMAGE_MAGIC || header.headerVersion != BOOTLOADER_IMAGE_HEADER_VERSION ||
+			header.flags != 0 || header.length > (BOOTLOADER_SLOT_SIZE - sizeof(header))) {
+		return kErrImageInvalid;
+	}
+
+	// nothing to do if the image is already installed
+	if(header.crc32 == installed->crc32) {
+		return kErrSuccess;
+	}
+
+	// install it (only the pages that changed), then record that it's installed
+	if(header.type == BOOTLOADER_IMAGE_TYPE_RAW) {
+		err = upgrade_copy(address + sizeof(header), header.length, header.crc32,
+				kUpgradeDifferential | kUpgradeReadback, NULL);
+#ifdef UPGRADE_DELTA
+	} else if(header.type == BOOTLOADER_IMAGE_TYPE_DELTA) {
+		err = upgrade_apply_delta(address + sizeof(header), header.length, header.crc32, NULL);
+#endif
+#ifdef UPGRADE_LZ
+	} else if(header.type == BOOTLOADER_IMAGE_TYPE_LZ) {
+		err = upgrade_decompress(address + sizeof(header), header.length, header.crc32, NULL);
+#endif
+	} else {
+		err = kErrImageInvalid;
+	}
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	err = flash_unlock();
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	uint32_t crc = header.crc32;
+	err = flash_program(sizeof(crc), &crc, UPGRADE_CRC_ADDRESS);
+
+	flash_lock();
+
+	return err;
+}
+
+/**
+ * Checks whether n bytes (an even number) of internal flash at the given
+ * address are erased.
+ */
+static bool upgrade_is_blank(uint32_t address, size_t nBytes) {
+	const uint16_t *data = (const uint16_t *) address;
+
+	for(size_t i = 0; i < (nBytes / 2); i++) {
+		if(data[i] != 0xFFFF) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Erases all pages of the application region after the first n bytes, unless
+ * they are blank already. The flash must be unlocked.
+ */
+static int upgrade_erase_tail(uint32_t length) {
+	int err = kErrSuccess;
+	uint32_t page = BOOTLOADER_APP_ADDRESS + ((length + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1));
+
+	for(; err >= kErrSuccess && page < (BOOTLOADER_APP_ADDRESS + BOOTLOADER_APP_SIZE); page += FLASH_PAGE_SIZE) {
+		if(!upgrade_is_blank(page, FLASH_PAGE_SIZE)) {
+			err = flash_erase_page(page);
+		}
+	}
+
+	return err;
+}
+
+/**
+ * Programs the page buffer into the internal flash page at the given address,
+ * unless the page already contains the same data (and is blank after it.) An
+ * odd length is rounded up, so the byte after the data in the page buffer must
+ * be valid.
+ */
+static int upgrade_write_page(uint32_t dest, size_t nBytes, upgrade_stats_t *stats) {
+	int err;
+
+	nBytes = (nBytes + 1) & ~1;
+
+	if(memcmp(gBuffers.page, (const void *) dest, nBytes) == 0 &&
+			upgrade_is_blank(dest + nBytes, FLASH_PAGE_SIZE - nBytes)) {
+		if(stats != NULL) {
+			stats->pagesSkipped++;
+		}
+
+		return kErrSuccess;
+	}
+
+	err = flash_erase_page(dest);
+
+	if(err >= kErrSuccess) {
+		err = flash_program(nBytes, gBuffers.page, dest);
+	}
+
+	if(err >= kErrSuccess && stats != NULL) {
+		stats->pagesWritten++;
+	}
+
+	return err;
+}
+
+/**
+ * Clears the CRC of the installed image, once it's about to be overwritten;
+ * clearing bits is always possible without an erase. The flash must be
+ * unlocked.
+ */
+static int upgrade_clear_crc(void) {
+	uint32_t crc = 0;
+	return flash_program(sizeof(crc), &crc, UPGRADE_CRC_ADDRESS);
+}
+
+/**
+ * Locks the flash once an image has been written, passing through the given
+ * error. If the image wasn't written successfully, its CRC is cleared again
+ * first: erasing the page holding the version block sets it to 0xFFFFFFFF.
+ */
+static int upgrade_finish(int err) {
+	if(err < kErrSuccess) {
+		upgrade_clear_crc();
+	}
+
+	flash_lock();
+
+	return err;
+}
+
+/**
+ * Adds n bytes of image data to the CRC, leaving out the padding at the end of
+ * an odd length image.
+ */
+static void upgrade_add_crc(const void *data, size_t nBytes) {
+	if(nBytes > gCopy.remaining) {
+		nBytes = gCopy.remaining;
+	}
+
+	gCopy.crc = crc32_update(gCopy.crc, data, nBytes);
+	gCopy.remaining -= nBytes;
+}
+
+#ifdef UPGRADE_STREAM
+/**
+ * Streams n bytes from the SPI flash in chunks, calling the given function for
+ * each chunk along with the internal flash address it corresponds to. While
+ * the function runs, the next chunk is already being read by DMA.
+ *
+ * Streaming stops early if the function returns anything but kErrSuccess; that
+ * value is then returned.
+ */
+static int upgrade_stream(uint32_t source, uint32_t dest, size_t nBytes, upgrade_chunk_fn fn) {
+	int err;
+	int current = 0;
+
+	// start reading the first chunk
+	size_t chunkLen = (nBytes > UPGRADE_CHUNK_SIZE) ? UPGRADE_CHUNK_SIZE : nBytes;
+
+	err = spiflash_read_start(chunkLen, gBuffers.chunks[current], source);
+
+	while(err == kErrSuccess && chunkLen != 0) {
+		spiflash_read_finish();
+
+		gCopy.bytesRead += chunkLen;
+		source += chunkLen;
+		nBytes -= chunkLen;
+
+		// start reading the next chunk into the other buffer
+		size_t nextLen = (nBytes > UPGRADE_CHUNK_SIZE) ? UPGRADE_CHUNK_SIZE : nBytes;
+
+		if(nextLen != 0) {
+			err = spiflash_read_start(nextLen, gBuffers.chunks[current ^ 1], source);
+
+			if(err < kErrSuccess) {
+				return err;
+			}
+		}
+
+		// meanwhile, process this chunk
+		err = fn(gBuffers.chunks[current], chunkLen, dest);
+
+		if(err != kErrSuccess && nextLen != 0) {
+			spiflash_read_finish();
+		}
+
+		dest += chunkLen;
+		chunkLen = nextLen;
+		current ^= 1;
+	}
+
+	return err;
+}
+
+/**
+ * Programs a chunk into internal flash, erasing the page first if the chunk is
+ * at the start of one. The data is added to the CRC as it's programmed.
+ */
+static int upgrade_program_chunk(const void *chunk, size_t nBytes, uint32_t dest) {
+	int err = kErrSuccess;
+
+	if((dest & (FLASH_PAGE_SIZE - 1)) == 0) {
+		err = flash_erase_page(dest);
+	}
+
+	if(err >= kErrSuccess) {
+		err = flash_program(nBytes, chunk, dest);
+	}
+
+	upgrade_add_crc(chunk, nBytes);
+
+	return err;
+}
+#endif
+
+/**
+ * Reads n bytes (at most a page) from the SPI flash into the page buffer, in
+ * chunks: each chunk is added to the CRC while the next one is read by DMA.
+ */
+static int upgrade_read_page(uint32_t source, size_t nBytes) {
+	int err;
+	uint8_t *page = (uint8_t *) gBuffers.page;
+	size_t offset = 0;
+
+	// start reading the first chunk
+	size_t chunkLen = (nBytes > UPGRADE_CHUNK_SIZE) ? UPGRADE_CHUNK_SIZE : nBytes;
+
+	err = spiflash_read_start(chunkLen, page, source);
+
+	while(err >= kErrSuccess && chunkLen != 0) {
+		spiflash_read_finish();
+		gCopy.bytesRead += chunkLen;
+
+		// start reading the next chunk, and meanwhile add this one to the CRC
+		size_t next = offset + chunkLen;
+		size_t nextLen = nBytes - next;
+
+		if(nextLen > UPGRADE_CHUNK_SIZE) {
+			nextLen = UPGRADE_CHUNK_SIZE;
+		}
+
+		if(nextLen != 0) {
+			err = spiflash_read_start(nextLen, page + next, source + next);
+		}
+
+		upgrade_add_crc(page + offset, chunkLen);
+
+		offset = next;
+		chunkLen = nextLen;
+	}
+
+	return err;
+}
+
+/**
+ * Copies n bytes from the specified address in the SPI flash to the start of
+ * the application region in internal flash, and checks them against the given
+ * CRC.
+ *
+ * In differential mode, each page is read into the page buffer and compared
+ * against internal flash, and only pages that differ are erased and programmed,
+ * from that same buffer. Otherwise, chunks are programmed as they arrive, while
+ * the next one is being read. Either way, each byte is read from the SPI flash
+ * once. Copies that aren't differential are only supported if UPGRADE_STREAM
+ * is defined.
+ *
+ * The CRC is computed over the data as it is read. In readback mode, a second
+ * CRC is computed over the pages as they read back from internal flash.
+ *
+ * Statistics are written to stats, if specified.
+ */
+int upgrade_copy(uint32_t source, size_t nBytes, uint32_t crc, uint8_t flags, upgrade_stats_t *stats) {
+	int err;
+	uint32_t dest = BOOTLOADER_APP_ADDRESS;
+	uint32_t length = nBytes;
+
+	// validate parameters
+	if(nBytes > BOOTLOADER_APP_SIZE) {
+		return kErrInvalidArgs;
+	}
+
+#ifndef UPGRADE_STREAM
+	if(!(flags & kUpgradeDifferential)) {
+		return kErrUnimplemented;
+	}
+#endif
+
+	memset(&gCopy, 0, sizeof(gCopy));
+	gCopy.remaining = nBytes;
+
+	if(stats != NULL) {
+		stats->pagesWritten = stats->pagesSkipped = 0;
+	}
+
+	err = flash_unlock();
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	err = upgrade_clear_crc();
+
+	// process the image page by page; round up to whole half-words
+	nBytes = (nBytes + 1) & ~1;
+
+	while(err >= kErrSuccess && nBytes != 0) {
+		size_t pageLen = (nBytes > FLASH_PAGE_SIZE) ? FLASH_PAGE_SIZE : nBytes;
+		size_t crcLen = (gCopy.remaining > pageLen) ? pageLen : gCopy.remaining;
+
+		// in differential mode, skip pages that already contain the new data
+		if(flags & kUpgradeDifferential) {
+			err = upgrade_read_page(source, pageLen);
+
+			if(err >= kErrSuccess) {
+				err = upgrade_write_page(dest, pageLen, stats);
+			}
+		}
+#ifdef UPGRADE_STREAM
+		else {
+			err = upgrade_stream(source, dest, pageLen, upgrade_program_chunk);
+
+			if(stats != NULL) {
+				stats->pagesWritten++;
+			}
+		}
+#endif
+
+		if(flags & kUpgradeReadback) {
+			gCopy.readbackCrc = crc32_update(gCopy.readbackCrc, (const void *) dest, crcLen);
+			gCopy.verifyBytes += crcLen;
+		}
+
+		source += pageLen;
+		dest += pageLen;
+		nBytes -= pageLen;
+	}
+
+	// check the CRCs
+	if(err >= kErrSuccess) {
+		if(gCopy.crc != crc) {
+			err = kErrImageCorrupt;
+		} else if((flags & kUpgradeReadback) && gCopy.readbackCrc != crc) {
+			err = kErrFlashProgram;
+		} else {
+			err = upgrade_erase_tail(length);
+		}
+	}
+
+	err = upgrade_finish(err);
+
+	if(stats != NULL) {
+		stats->bytesRead = gCopy.bytesRead;
+		stats->verifyBytes = gCopy.verifyBytes;
+	}
+
+	return err;
+}
+
+
+
+#ifdef UPGRADE_DELTA
+/**
+ * Reads n bytes of a delta at the cursor, and advances it. The read may not go
+ * past the end of the delta.
+ */
+static int upgrade_delta_read(uint32_t *cursor, uint32_t end, size_t nBytes, void *buf) {
+	if(nBytes > (end - *cursor)) {
+		return kErrImageInvalid;
+	}
+
+	int err = spiflash_read(nBytes, buf, *cursor);
+	*cursor += nBytes;
+
+	return err;
+}
+
+/**
+ * Assembles the page of delta output at the given offset into the page buffer,
+ * by executing the ops at the cursor. Each block is checked against its CRC.
+ */
+static int upgrade_delta_page(uint32_t *cursor, uint32_t end, uint32_t offset, size_t pageLen) {
+	int err;
+	uint8_t *page = (uint8_t *) gBuffers.page;
+
+	memset(page, 0xFF, sizeof(gBuffers.page));
+
+	for(size_t block = 0; block < pageLen; block += BOOTLOADER_DELTA_BLOCK_SIZE) {
+		uint32_t blockStart = offset + block;
+		size_t blockLen = pageLen - block;
+
+		if(blockLen > BOOTLOADER_DELTA_BLOCK_SIZE) {
+			blockLen = BOOTLOADER_DELTA_BLOCK_SIZE;
+		}
+
+		uint32_t crc;
+		err = upgrade_delta_read(cursor, end, sizeof(crc), &crc);
+
+		if(err < kErrSuccess) {
+			return err;
+		}
+
+		// execute ops until the block is filled
+		for(size_t filled = 0; filled < blockLen;) {
+			uint16_t op[2];
+			err = upgrade_delta_read(cursor, end, sizeof(op[0]), &op[0]);
+
+			if(err < kErrSuccess) {
+				return err;
+			}
+
+			size_t len = op[0] & ~BOOTLOADER_DELTA_COPY;
+			uint8_t *out = page + block + filled;
+
+			if(len == 0 || len > (blockLen - filled)) {
+				return kErrImageInvalid;
+			}
+
+			if(op[0] & BOOTLOADER_DELTA_COPY) {
+				err = upgrade_delta_read(cursor, end, sizeof(op[1]), &op[1]);
+
+				if(err < kErrSuccess) {
+					return err;
+				}
+
+				// data before this block may have been overwritten already
+				uint32_t source = BOOTLOADER_APP_ADDRESS + op[1];
+
+				if(op[1] < blockStart || (source + len) > UPGRADE_CRC_ADDRESS) {
+					return kErrImageInvalid;
+				}
+
+				memcpy(out, (const void *) source, len);
+			} else {
+				err = upgrade_delta_read(cursor, end, len, out);
+
+				if(err < kErrSuccess) {
+					return err;
+				}
+			}
+
+			filled += len;
+		}
+
+		if(crc32_update(0, page + block, blockLen) != crc) {
+			return kErrImageCorrupt;
+		}
+	}
+
+	return kErrSuccess;
+}
+
+/**
+ * Runs one pass over the ops of a delta, starting at the cursor, to produce
+ * output of the given length, and checks the output against the given CRC. If
+ * program is set, the pages are written to internal flash, unless they are
+ * unchanged; the CRC then covers the pages as they were written.
+ */
+static int upgrade_delta_pass(uint32_t cursor, uint32_t end, uint32_t length, uint32_t crc, bool program, upgrade_stats_t *stats) {
+	int err;
+	uint32_t outputCrc = 0;
+
+	for(uint32_t offset = 0; offset < length; offset += FLASH_PAGE_SIZE) {
+		size_t pageLen = length - offset;
+
+		if(pageLen > FLASH_PAGE_SIZE) {
+			pageLen = FLASH_PAGE_SIZE;
+		}
+
+		err = upgrade_delta_page(&cursor, end, offset, pageLen);
+
+		if(err < kErrSuccess) {
+			return err;
+		}
+
+		outputCrc = crc32_update(outputCrc, gBuffers.page, pageLen);
+
+		if(!program) {
+			continue;
+		}
+
+		err = upgrade_write_page(BOOTLOADER_APP_ADDRESS + offset, pageLen, stats);
+
+		if(err < kErrSuccess) {
+			return err;
+		}
+	}
+
+	return (outputCrc == crc) ? kErrSuccess : kErrImageCorrupt;
+}
+
+/**
+ * Applies the delta of n bytes at the specified address in the SPI flash to
+ * the image installed in internal flash. The output must match the given CRC.
+ *
+ * The delta is applied twice: the first pass only checks that every block of
+ * output matches its CRC, and the whole output matches the image's, so a
+ * corrupt delta is rejected before anything is written. Before the second
+ * pass, the CRC of the installed image is cleared, since it will no longer be
+ * a valid base if the copy is interrupted. The second pass checks the output
+ * it wrote against the image's CRC again. Pages whose contents don't change
+ * are skipped.
+ */
+int upgrade_apply_delta(uint32_t source, size_t nBytes, uint32_t crc, upgrade_stats_t *stats) {
+	int err;
+	uint32_t end = source + nBytes;
+
+	const bootloader_version_t *installed = (const bootloader_version_t *) BOOTLOADER_VERSION_ADDRESS;
+
+	// validate the delta header
+	bootloader_delta_header_t delta;
+	err = upgrade_delta_read(&source, end, sizeof(delta), &delta);
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	if(delta.baseCrc != installed->crc32) {
+		return kErrImageBase;
+	} else if(delta.length > BOOTLOADER_APP_SIZE) {
+		return kErrImageInvalid;
+	}
+
+	if(stats != NULL) {
+		stats->pagesWritten = stats->pagesSkipped = 0;
+	}
+
+	// check the whole delta before touching the flash
+	err = upgrade_delta_pass(source, end, delta.length, crc, false, NULL);
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	err = flash_unlock();
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	err = upgrade_clear_crc();
+
+	if(err >= kErrSuccess) {
+		err = upgrade_delta_pass(source, end, delta.length, crc, true, stats);
+	}
+
+	if(err >= kErrSuccess) {
+		err = upgrade_erase_tail(delta.length);
+	}
+
+	return upgrade_finish(err);
+}
+#endif
+
+
+
+#ifdef UPGRADE_LZ
+/**
+ * Returns the next byte of compressed data, or an error if there is none.
+ */
+static int upgrade_lz_next(void) {
+	int err;
+
+	if(gLz.pos == gLz.len) {
+		size_t len = gLz.end - gLz.address;
+
+		if(len == 0) {
+			return kErrImageInvalid;
+		} else if(len > UPGRADE_LZ_INPUT_SIZE) {
+			len = UPGRADE_LZ_INPUT_SIZE;
+		}
+
+		err = spiflash_read(len, gLz.input, gLz.address);
+
+		if(err < kErrSuccess) {
+			return err;
+		}
+
+		gLz.address += len;
+		gLz.pos = 0;
+		gLz.len = len;
+	}
+
+	return gLz.input[gLz.pos++];
+}
+
+/**
+ * Appends a byte to the output. Once a page is complete (or the output is) it
+ * is programmed.
+ */
+static int upgrade_lz_put(uint8_t byte) {
+	uint8_t *page = (uint8_t *) gBuffers.page;
+
+	page[gLz.offset++ & (FLASH_PAGE_SIZE - 1)] = byte;
+
+	if((gLz.offset & (FLASH_PAGE_SIZE - 1)) != 0 && gLz.offset != gLz.length) {
+		return kErrSuccess;
+	}
+
+	// the last page may be partial; pad it to a whole half-word
+	uint32_t pageStart = (gLz.offset - 1) & ~(FLASH_PAGE_SIZE - 1);
+	size_t pageLen = gLz.offset - pageStart;
+
+	if(pageLen & 1) {
+		page[pageLen] = 0xFF;
+	}
+
+	gLz.crc = crc32_update(gLz.crc, page, pageLen);
+
+	return upgrade_write_page(BOOTLOADER_APP_ADDRESS + pageStart, pageLen, gLz.stats);
+}
+
+/**
+ * Decompresses the output, until it is complete.
+ */
+static int upgrade_lz_run(void) {
+	int err;
+	uint8_t *page = (uint8_t *) gBuffers.page;
+
+	// flags are shifted out; the high byte marks how many are left
+	uint16_t flags = 0;
+
+	while(gLz.offset < gLz.length) {
+		if((flags & 0xFF00) == 0) {
+			err = upgrade_lz_next();
+
+			if(err < kErrSuccess) {
+				return err;
+			}
+
+			flags = (uint16_t) err | 0xFF00;
+		}
+
+		if(flags & 1) {
+			// literal byte
+			err = upgrade_lz_next();
+
+			if(err >= kErrSuccess) {
+				err = upgrade_lz_put((uint8_t) err);
+			}
+		} else {
+			// reference to earlier output
+			int lo = upgrade_lz_next();
+			int hi = upgrade_lz_next();
+
+			if(lo < kErrSuccess || hi < kErrSuccess) {
+				return (lo < kErrSuccess) ? lo : hi;
+			}
+
+			uint32_t distance = (((hi & 0x0F) << 8) | lo) + 1;
+			size_t len = (hi >> 4) + BOOTLOADER_LZ_MIN_MATCH;
+
+			if(distance > gLz.offset || len > (gLz.length - gLz.offset)) {
+				return kErrImageInvalid;
+			}
+
+			// earlier pages have been programmed already
+			for(err = kErrSuccess; len != 0 && err >= kErrSuccess; len--) {
+				uint32_t from = gLz.offset - distance;
+				uint8_t byte;
+
+				if((from & ~(FLASH_PAGE_SIZE - 1)) == (gLz.offset & ~(FLASH_PAGE_SIZE - 1))) {
+					byte = page[from & (FLASH_PAGE_SIZE - 1)];
+				} else {
+					byte = *((const uint8_t *) (BOOTLOADER_APP_ADDRESS + from));
+				}
+
+				err = upgrade_lz_put(byte);
+			}
+		}
+
+		if(err < kErrSuccess) {
+			return err;
+		}
+
+		flags >>= 1;
+	}
+
+	return kErrSuccess;
+}
+
+/**
+ * Decompresses the compressed image of n bytes at the specified address in the
+ * SPI flash into internal flash, straight from the SPI flash reads into the page
+ * buffer. The output must match the given CRC.
+ *
+ * Pages whose contents don't change are skipped.
+ */
+int upgrade_decompress(uint32_t source, size_t nBytes, uint32_t crc, upgrade_stats_t *stats) {
+	int err;
+
+	// validate the header
+	bootloader_lz_header_t lz;
+
+	if(nBytes < sizeof(lz)) {
+		return kErrImageInvalid;
+	}
+
+	err = spiflash_read(sizeof(lz), &lz, source);
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	if(lz.length > BOOTLOADER_APP_SIZE) {
+		return kErrImageInvalid;
+	}
+
+	// set up state
+	memset(&gLz, 0, sizeof(gLz));
+
+	gLz.address = source + sizeof(lz);
+	gLz.end = source + nBytes;
+	gLz.length = lz.length;
+	gLz.stats = stats;
+
+	if(stats != NULL) {
+		stats->pagesWritten = stats->pagesSkipped = 0;
+	}
+
+	// decompress it
+	err = flash_unlock();
+
+	if(err < kErrSuccess) {
+		return err;
+	}
+
+	err = upgrade_clear_crc();
+
+	if(err >= kErrSuccess) {
+		err = upgrade_lz_run();
+	}
+
+	if(err >= kErrSuccess && gLz.crc != crc) {
+		err = kErrImageCorrupt;
+	}
+
+	if(err >= kErrSuccess) {
+		err = upgrade_erase_tail(lz.length);
+	}
+
+	return upgrade_finish(err);
+}
+#endif
@@ -0,0 +1,69 @@
+/*
+ * upgrade.h
+ *
+ * Copies firmware images from the SPI flash into the internal flash.
+ */
+
+#ifndef UPGRADE_H_
+#define UPGRADE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Options for copying an image.
+ */
+enum {
+	/// only erase and program pages whose contents differ
+	kUpgradeDifferential		= (1 << 0),
+	/// also check the CRC of the programmed data, read back from flash
+	kUpgradeReadback			= (1 << 1),
+};
+
+/**
+ * Statistics about copying an image.
+ */
+typedef struct {
+	/// internal flash pages that were erased and programmed
+	uint16_t pagesWritten;
+	/// internal flash pages that already contained the new data
+	uint16_t pagesSkipped;
+
+	/// bytes read from the SPI flash (only set by upgrade_copy)
+	uint32_t bytesRead;
+	/// bytes read back from internal flash to verify the image (only set by
+	/// upgrade_copy, in readback mode)
+	uint32_t verifyBytes;
+} upgrade_stats_t;
+
+/**
+ * Installs the image in the given firmware slot, unless it is installed
+ * already.
+ */
+int upgrade_install(uint8_t slot);
+
+/**
+ * Copies n bytes from the specified address in the SPI flash to the start of
+ * the application region in internal flash, and checks them against the given
+ * CRC while copying.
+ */
+int upgrade_copy(uint32_t source, size_t nBytes, uint32_t crc, uint8_t flags, upgrade_stats_t *stats);
+
+#ifdef UPGRADE_DELTA
+/**
+ * Applies the delta of n bytes at the specified address in the SPI flash to
+ * the image installed in internal flash. The output must match the given CRC.
+ */
+int upgrade_apply_delta(uint32_t source, size_t nBytes, uint32_t crc, upgrade_stats_t *stats);
+#endif
+
+#ifdef UPGRADE_LZ
+/**
+ * Decompresses the compressed image of n bytes at the specified address in the
+ * SPI flash into internal flash. The output must match the given CRC.
+ */
+int upgrade_decompress(uint32_t source, size_t nBytes, uint32_t crc, upgrade_stats_t *stats);
+#endif
+
+#endif /* UPGRADE_H_ */
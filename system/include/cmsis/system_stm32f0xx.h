@@ -67,6 +67,16 @@
   * @{
   */
 
+/**
+  * @}
+  */
+
+/** @addtogroup STM32F0xx_System_Exported_Variables
+  * @{
+  */
+
+extern uint32_t SystemCoreClock;          /*!< System Clock Frequency (Core Clock) */
+
 /**
   * @}
   */
@@ -76,6 +86,7 @@
   */
   
 extern void SystemInit(void);
+extern void SystemCoreClockUpdate(void);
 /**
   * @}
   */
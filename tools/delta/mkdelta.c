@@ -0,0 +1,299 @@
+/*
+ * mkdelta.c
+ *
+ * Generates a delta image, which turns the installed firmware image into a new
+ * one, and writes it (including the image header) so it can be stored in a
+ * firmware slot as is. Build with:
+ *
+ *   cc -I../../include -I../../src -o mkdelta mkdelta.c ../../src/crc32.c
+ *
+ * and run as:
+ *
+ *   mkdelta old.bin new.bin version out.bin
+ *
+ * where version is the firmware version of the new image, in hex.
+ *
+ * The delta is applied back to the old image before it's written, to check
+ * that it produces the new image.
+ */
+#include "bootloader.h"
+#include "crc32.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// offset of the version block's CRC in an image; it's never a copy source
+#define DELTA_CRC_OFFSET			(BOOTLOADER_VERSION_ADDRESS + \
+										offsetof(bootloader_version_t, crc32) - \
+										BOOTLOADER_APP_ADDRESS)
+/// shortest match worth encoding as a copy, rather than as literals
+#define DELTA_MIN_COPY				8
+
+/// old and new images
+static uint8_t gOld[BOOTLOADER_APP_SIZE];
+static uint8_t gNew[BOOTLOADER_APP_SIZE];
+static size_t gOldLen, gNewLen;
+
+/// delta being generated (never larger than the new image, plus overhead)
+static uint8_t gDelta[BOOTLOADER_APP_SIZE * 2];
+static size_t gDeltaLen = 0;
+
+
+
+/**
+ * Reads a firmware image from a file, and returns its length without trailing
+ * 0xFF bytes, or 0 on error.
+ */
+static size_t delta_read_file(const char *path, uint8_t *buf) {
+	FILE *fp = fopen(path, "rb");
+
+	if(fp == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	size_t len = fread(buf, 1, BOOTLOADER_APP_SIZE, fp);
+
+	if(!feof(fp) && fgetc(fp) != EOF) {
+		fprintf(stderr, "%s: larger than %u bytes\n", path, BOOTLOADER_APP_SIZE);
+		len = 0;
+	}
+
+	fclose(fp);
+
+	// trailing 0xFF bytes are not part of the image
+	while(len != 0 && buf[len - 1] == 0xFF) {
+		len--;
+	}
+
+	return len;
+}
+
+/**
+ * Appends bytes to the delta.
+ */
+static void delta_emit(const void *data, size_t len) {
+	memcpy(gDelta + gDeltaLen, data, len);
+	gDeltaLen += len;
+}
+
+/**
+ * Appends a 16-bit little endian word to the delta.
+ */
+static void delta_emit16(uint16_t word) {
+	uint8_t bytes[2] = {(uint8_t) word, (uint8_t) (word >> 8)};
+	delta_emit(bytes, sizeof(bytes));
+}
+
+/**
+ * Appends a 32-bit little endian word to the delta.
+ */
+static void delta_emit32(uint32_t word) {
+	delta_emit16((uint16_t) word);
+	delta_emit16((uint16_t) (word >> 16));
+}
+
+/**
+ * Returns the length of the match between the new image at the given offset,
+ * and the old image at the given source offset, up to max bytes.
+ */
+static size_t delta_match(size_t offset, size_t source, size_t max) {
+	size_t limit = (gOldLen < DELTA_CRC_OFFSET) ? gOldLen : DELTA_CRC_OFFSET;
+
+	if(source >= limit) {
+		return 0;
+	} else if(max > (limit - source)) {
+		max = limit - source;
+	}
+
+	size_t len = 0;
+
+	while(len < max && gOld[source + len] == gNew[offset + len]) {
+		len++;
+	}
+
+	return len;
+}
+
+/**
+ * Encodes a block of the new image: its CRC, then the ops that produce it.
+ *
+ * Matches at the same offset, and continuing the previous copy, are tried
+ * first, as they are by far the most common; otherwise, the old image is
+ * searched from the start of the block onwards.
+ */
+static void delta_encode_block(size_t start, size_t blockLen) {
+	size_t end = start + blockLen;
+	size_t literalStart = start;
+	size_t nextSource = start;
+
+	delta_emit32(crc32_update(0, gNew + start, blockLen));
+
+	for(size_t i = start; i < end;) {
+		size_t bestLen = 0, bestSource = 0;
+		const size_t candidates[2] = {i, nextSource};
+
+		for(int c = 0; c < 2; c++) {
+			size_t len = delta_match(i, candidates[c], end - i);
+
+			if(len > bestLen) {
+				bestLen = len;
+				bestSource = candidates[c];
+			}
+		}
+
+		if(bestLen < (end - i)) {
+			for(size_t j = start; j < gOldLen; j++) {
+				size_t len = delta_match(i, j, end - i);
+
+				if(len > bestLen) {
+					bestLen = len;
+					bestSource = j;
+				}
+			}
+		}
+
+		if(bestLen < DELTA_MIN_COPY) {
+			i++;
+			continue;
+		}
+
+		// flush literals before the copy
+		if(literalStart != i) {
+			delta_emit16((uint16_t) (i - literalStart));
+			delta_emit(gNew + literalStart, i - literalStart);
+		}
+
+		delta_emit16((uint16_t) (BOOTLOADER_DELTA_COPY | bestLen));
+		delta_emit16((uint16_t) bestSource);
+
+		i += bestLen;
+		literalStart = i;
+		nextSource = bestSource + bestLen;
+	}
+
+	if(literalStart != end) {
+		delta_emit16((uint16_t) (end - literalStart));
+		delta_emit(gNew + literalStart, end - literalStart);
+	}
+}
+
+/**
+ * Applies the delta to the old image the way the loader does, and checks that
+ * the result is the new image. Returns 0 if so.
+ */
+static int delta_verify(void) {
+	static uint8_t out[BOOTLOADER_APP_SIZE];
+	size_t pos = sizeof(bootloader_delta_header_t);
+
+	for(size_t start = 0; start < gNewLen; start += BOOTLOADER_DELTA_BLOCK_SIZE) {
+		size_t blockLen = gNewLen - start;
+
+		if(blockLen > BOOTLOADER_DELTA_BLOCK_SIZE) {
+			blockLen = BOOTLOADER_DELTA_BLOCK_SIZE;
+		}
+
+		uint32_t crc;
+		memcpy(&crc, gDelta + pos, sizeof(crc));
+		pos += sizeof(crc);
+
+		for(size_t filled = 0; filled < blockLen;) {
+			uint16_t op = (uint16_t) (gDelta[pos] | (gDelta[pos + 1] << 8));
+			size_t len = op & ~BOOTLOADER_DELTA_COPY;
+			pos += 2;
+
+			if(op & BOOTLOADER_DELTA_COPY) {
+				size_t source = gDelta[pos] | (gDelta[pos + 1] << 8);
+				pos += 2;
+
+				if(source < start || (source + len) > DELTA_CRC_OFFSET) {
+					return -1;
+				}
+
+				memcpy(out + start + filled, gOld + source, len);
+			} else {
+				memcpy(out + start + filled, gDelta + pos, len);
+				pos += len;
+			}
+
+			filled += len;
+		}
+
+		if(crc32_update(0, out + start, blockLen) != crc) {
+			return -1;
+		}
+	}
+
+	return (pos == gDeltaLen && !memcmp(out, gNew, gNewLen)) ? 0 : -1;
+}
+
+
+
+int main(int argc, char **argv) {
+	if(argc != 5) {
+		fprintf(stderr, "usage: %s old.bin new.bin version out.bin\n", argv[0]);
+		return 1;
+	}
+
+	// read the images
+	memset(gOld, 0xFF, sizeof(gOld));
+
+	gOldLen = delta_read_file(argv[1], gOld);
+	gNewLen = delta_read_file(argv[2], gNew);
+
+	if(gOldLen == 0 || gNewLen == 0) {
+		return 1;
+	}
+
+	// the loader identifies images by the CRC of their contents
+	uint32_t oldCrc = crc32_update(0, gOld, gOldLen);
+	uint32_t newCrc = crc32_update(0, gNew, gNewLen);
+
+	// generate the delta
+	delta_emit32(oldCrc);
+	delta_emit32((uint32_t) gNewLen);
+
+	for(size_t start = 0; start < gNewLen; start += BOOTLOADER_DELTA_BLOCK_SIZE) {
+		size_t blockLen = gNewLen - start;
+
+		if(blockLen > BOOTLOADER_DELTA_BLOCK_SIZE) {
+			blockLen = BOOTLOADER_DELTA_BLOCK_SIZE;
+		}
+
+		delta_encode_block(start, blockLen);
+	}
+
+	if(delta_verify() != 0) {
+		fprintf(stderr, "delta does not reproduce %s\n", argv[2]);
+		return 1;
+	}
+
+	// write it out, with the image header
+	bootloader_image_header_t header = {
+		.magic = BOOTLOADER_IMAGE_MAGIC,
+		.headerVersion = BOOTLOADER_IMAGE_HEADER_VERSION,
+		.type = BOOTLOADER_IMAGE_TYPE_DELTA,
+		.flags = 0,
+
+		.length = (uint32_t) gDeltaLen,
+		.crc32 = newCrc,
+
+		.version = (uint16_t) strtoul(argv[3], NULL, 16),
+		.reserved = 0xFFFF
+	};
+
+	FILE *fp = fopen(argv[4], "wb");
+
+	if(fp == NULL) {
+		perror(argv[4]);
+		return 1;
+	}
+
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(gDelta, 1, gDeltaLen, fp);
+	fclose(fp);
+
+	printf("%zu byte image -> %zu byte delta\n", gNewLen, gDeltaLen);
+	return 0;
+}
@@ -0,0 +1,364 @@
+/*
+ * flashbench.c
+ *
+ * Runs a set of standard workloads through the SPI flash driver against the
+ * flash model, and prints a table of the bus traffic and modeled time of each.
+ * The output is deterministic, so it can be diffed between commits. Build with:
+ *
+ *   cc -I../../include -I../../src -I../../src/drivers -o flashbench \
+ *     flashbench.c flashsim.c spi_sim.c ../../src/drivers/spi_flash.c \
+ *     ../../src/journal.c ../../src/counters.c ../../src/flash_callbacks.c \
+ *     ../../src/crc32.c
+ *
+ * Each workload's result is checked afterwards (data read back, the state of the
+ * flash, or the boot state as reloaded from it); the benchmark fails if any of
+ * them are wrong, or if the model saw a protocol violation.
+ */
+#include "flashsim.h"
+
+#include "bootloader.h"
+#include "counters.h"
+#include "crc32.h"
+#include "journal.h"
+#include "flash_callbacks.h"
+#include "spi.h"
+#include "spi_flash.h"
+#include "errors.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// address of the loader info block in the SPI flash
+#define BENCH_INFO_ADDRESS			0x000000
+/// address of the firmware slot used by the workloads
+#define BENCH_SLOT_ADDRESS			0x008000
+/// size of a firmware slot
+#define BENCH_SLOT_SIZE				0x8000
+/// size of a firmware image
+#define BENCH_IMAGE_SIZE			0x7000
+/// number of records in the journal before a workload runs
+#define BENCH_JOURNAL_RECORDS		64
+
+/**
+ * A single workload: the setup routine prepares the flash, and the check routine
+ * verifies the result afterwards; neither is measured.
+ */
+typedef struct {
+	const char *name;
+
+	void (*setup)(void);
+	int (*run)(void);
+	bool (*check)(void);
+} bench_workload_t;
+
+/// firmware image used by the workloads
+static uint8_t gImage[BENCH_IMAGE_SIZE];
+/// buffer for reading back data
+static uint8_t gBuffer[BENCH_IMAGE_SIZE];
+/// boot state journal, as loaded by the setup routines
+static journal_t gJournal;
+/// boot state expected after loading the journal
+static bootloader_info_t gExpected;
+
+
+
+/**
+ * Generates a pseudorandom firmware image, with 0xFF padding at the end as a
+ * real image would have.
+ */
+static void bench_make_image(void) {
+	uint32_t state = 0x12345678;
+
+	for(size_t i = 0; i < sizeof(gImage); i++) {
+		state = (state * 1103515245) + 12345;
+		gImage[i] = (uint8_t) (state >> 16);
+	}
+
+	memset(gImage + 0x6000, 0xFF, sizeof(gImage) - 0x6000);
+}
+
+/**
+ * Writes the firmware image into the slot.
+ */
+static void bench_setup_slot(void) {
+	memcpy(flashsim_array() + BENCH_SLOT_ADDRESS, gImage, sizeof(gImage));
+}
+
+/**
+ * Writes a loader info block.
+ */
+static void bench_setup_info(void) {
+	bootloader_info_t info;
+	memset(&info, 0xFF, sizeof(info));
+
+	info.header = BOOTLOADER_INFO_HEADER;
+	info.totalFirmwares = 1;
+	info.currentFirmware = 0;
+	info.failsafeFirmware = 0;
+
+	info.fwInfo[0].version = 0x0100;
+	info.fwInfo[0].startFails = 1;
+	info.fwInfo[0].startSuccesses = 4;
+
+	info.crc32 = crc32_update(0, &info, offsetof(bootloader_info_t, crc32));
+
+	memcpy(flashsim_array() + BENCH_INFO_ADDRESS, &info, sizeof(info));
+}
+
+/**
+ * Writes a loader info block, and a journal holding a number of boot and mark
+ * good records.
+ */
+static void bench_setup_journal(void) {
+	bench_setup_info();
+	journal_load(&kSpiFlashCallbacks, &gJournal);
+
+	for(int i = 0; i < BENCH_JOURNAL_RECORDS; i++) {
+		journal_append(&kSpiFlashCallbacks, &gJournal, (i & 1) ? kJournalGood : kJournalBoot, 0);
+	}
+
+	gExpected = gJournal.info;
+}
+
+/**
+ * Writes a loader info block and journal, and counts a number of failed starts
+ * for the current firmware.
+ */
+static void bench_setup_counters(void) {
+	bench_setup_journal();
+	counters_load(&kSpiFlashCallbacks, &gJournal);
+
+	for(int i = 0; i < 8; i++) {
+		counters_increment(&kSpiFlashCallbacks, &gJournal, 0);
+	}
+}
+
+/**
+ * Same as bench_setup_counters, but the current firmware has since been marked
+ * as good, so its counter must be reset.
+ */
+static void bench_setup_counter_reset(void) {
+	bench_setup_counters();
+	journal_append(&kSpiFlashCallbacks, &gJournal, kJournalGood, 0);
+}
+
+/**
+ * Writes a loader info block, and a journal whose active sector is full.
+ */
+static void bench_setup_full_journal(void) {
+	bench_setup_info();
+	journal_load(&kSpiFlashCallbacks, &gJournal);
+
+	do {
+		journal_append(&kSpiFlashCallbacks, &gJournal, kJournalBoot, 0);
+	} while((gJournal.next + 4) <= (gJournal.sector + BOOTLOADER_JOURNAL_SECTOR_SIZE));
+}
+
+
+
+/**
+ * Reads a whole firmware image.
+ */
+static int bench_read_image(void) {
+	return spiflash_read(sizeof(gBuffer), gBuffer, BENCH_SLOT_ADDRESS);
+}
+
+/**
+ * Programs a whole firmware image into an erased slot.
+ */
+static int bench_program_image(void) {
+	return spiflash_program_range(sizeof(gImage), gImage, BENCH_SLOT_ADDRESS);
+}
+
+/**
+ * Erases a firmware slot.
+ */
+static int bench_erase_slot(void) {
+	return spiflash_erase(BENCH_SLOT_SIZE, BENCH_SLOT_ADDRESS);
+}
+
+/**
+ * Reads the loader info block.
+ */
+static int bench_read_info(void) {
+	return spiflash_read(sizeof(bootloader_info_t), gBuffer, BENCH_INFO_ADDRESS);
+}
+
+/**
+ * Reads the info block, and replays the journal on top of it.
+ */
+static int bench_load_state(void) {
+	return journal_load(&kSpiFlashCallbacks, &gJournal);
+}
+
+/**
+ * Counts a boot attempt as a start failure.
+ */
+static int bench_record_boot(void) {
+	return counters_increment(&kSpiFlashCallbacks, &gJournal, 0);
+}
+
+/**
+ * Reads the start failure counters, resetting the one of the current firmware.
+ */
+static int bench_reset_counter(void) {
+	return counters_load(&kSpiFlashCallbacks, &gJournal);
+}
+
+/**
+ * Marks the current firmware as good in the journal.
+ */
+static int bench_mark_good(void) {
+	return journal_append(&kSpiFlashCallbacks, &gJournal, kJournalGood, gJournal.info.currentFirmware);
+}
+
+
+
+/**
+ * Checks that the image was read correctly.
+ */
+static bool bench_check_read_image(void) {
+	return !memcmp(gBuffer, gImage, sizeof(gImage));
+}
+
+/**
+ * Checks that the slot holds the image.
+ */
+static bool bench_check_slot(void) {
+	return !memcmp(flashsim_array() + BENCH_SLOT_ADDRESS, gImage, sizeof(gImage));
+}
+
+/**
+ * Checks that the slot is erased.
+ */
+static bool bench_check_erased(void) {
+	const uint8_t *slot = flashsim_array() + BENCH_SLOT_ADDRESS;
+
+	for(size_t i = 0; i < BENCH_SLOT_SIZE; i++) {
+		if(slot[i] != 0xFF) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Checks that the info block was read correctly.
+ */
+static bool bench_check_read_info(void) {
+	return !memcmp(gBuffer, flashsim_array() + BENCH_INFO_ADDRESS, sizeof(bootloader_info_t));
+}
+
+/**
+ * Checks that loading the journal resulted in the state it was written with.
+ */
+static bool bench_check_load_state(void) {
+	return !memcmp(&gJournal.info, &gExpected, sizeof(gExpected));
+}
+
+/**
+ * Checks that loading the journal from the flash again results in the same
+ * state as the workload left in memory.
+ */
+static bool bench_check_journal(void) {
+	journal_t journal;
+
+	if(journal_load(&kSpiFlashCallbacks, &journal) < kErrSuccess) {
+		return false;
+	}
+
+	return !memcmp(&journal.info, &gJournal.info, sizeof(journal.info)) &&
+			(journal.pendingResets == gJournal.pendingResets);
+}
+
+/**
+ * Same as bench_check_journal, but also reads back the start failure counters.
+ */
+static bool bench_check_counters(void) {
+	journal_t journal;
+
+	if(journal_load(&kSpiFlashCallbacks, &journal) < kErrSuccess ||
+			counters_load(&kSpiFlashCallbacks, &journal) < kErrSuccess) {
+		return false;
+	}
+
+	return !memcmp(&journal.info, &gJournal.info, sizeof(journal.info));
+}
+
+static const bench_workload_t kWorkloads[] = {
+	{"read image (28K)",		bench_setup_slot,			bench_read_image,		bench_check_read_image},
+	{"program image (28K)",		NULL,						bench_program_image,	bench_check_slot},
+	{"erase slot (32K)",		bench_setup_slot,			bench_erase_slot,		bench_check_erased},
+	{"read info block",			bench_setup_info,			bench_read_info,		bench_check_read_info},
+	{"load boot state",			bench_setup_journal,		bench_load_state,		bench_check_load_state},
+	{"record boot",				bench_setup_counters,		bench_record_boot,		bench_check_counters},
+	{"reset start counter",		bench_setup_counter_reset,	bench_reset_counter,	bench_check_counters},
+	{"mark firmware good",		bench_setup_journal,		bench_mark_good,		bench_check_journal},
+	{"compact journal",			bench_setup_full_journal,	bench_mark_good,		bench_check_journal},
+};
+
+
+
+int main(void) {
+	int err;
+
+	// set up the flash and driver
+	flashsim_reset();
+	bench_make_image();
+
+	spi_init();
+	spiflash_init();
+
+	printf("%-24s %10s %6s %8s %7s %12s\n", "workload", "bus bytes", "/CS",
+			"polls", "erases", "time (us)");
+
+	for(size_t i = 0; i < sizeof(kWorkloads) / sizeof(kWorkloads[0]); i++) {
+		const bench_workload_t *workload = &kWorkloads[i];
+
+		// start with an erased, idle flash
+		flashsim_advance(flashsim_idle_time() - flashsim_now());
+		memset(flashsim_array(), 0xFF, FLASHSIM_SIZE);
+
+		if(workload->setup != NULL) {
+			workload->setup();
+			flashsim_advance(flashsim_idle_time() - flashsim_now());
+		}
+
+		// run the workload, including the time the flash remains busy after
+		flashsim_clear_stats();
+		uint64_t start = flashsim_now();
+
+		err = workload->run();
+
+		uint64_t elapsed = flashsim_idle_time() - start;
+		flashsim_stats_t *stats = flashsim_stats();
+
+		if(err < kErrSuccess) {
+			printf("%-24s failed: %d\n", workload->name, err);
+			return 1;
+		}
+
+		printf("%-24s %10u %6u %8u %7u %12llu\n", workload->name,
+				stats->busBytes, stats->csAssertions, stats->statusPolls,
+				stats->eraseCommands, (unsigned long long) (elapsed / 1000));
+
+		// any protocol violation is a driver bug
+		if(stats->errWriteNotEnabled || stats->errCommandWhileBusy ||
+				stats->errProgramNotErased || stats->errPageWrap ||
+				stats->errBadCommand) {
+			printf("%-24s protocol violation\n", workload->name);
+			return 1;
+		}
+
+		// then check the result
+		if(!workload->check()) {
+			printf("%-24s wrong result\n", workload->name);
+			return 1;
+		}
+	}
+
+	return 0;
+}
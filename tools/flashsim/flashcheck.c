@@ -0,0 +1,303 @@
+/*
+ * flashcheck.c
+ *
+ * Self-check of the flash model: drives it at the command level (without the
+ * flash driver) and checks its command decoding, busy and timing model, and
+ * violation counters against the datasheet behaviour they're meant to model.
+ * Build with:
+ *
+ *   cc -o flashcheck flashcheck.c flashsim.c
+ *
+ * It prints each failed check, and exits with a non-zero status if any did.
+ */
+#include "flashsim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/// SPI clock used for all transactions
+#define CHECK_SCK					24000000
+/// nanoseconds taken to clock a byte at that clock
+#define CHECK_BYTE_NS				((8ULL * 1000000000ULL) / CHECK_SCK)
+
+/// address used for the program and erase checks
+#define CHECK_ADDRESS				0x012300
+
+/// number of failed checks
+static int gFailures = 0;
+
+
+
+/**
+ * Records the result of a check.
+ */
+static void check(bool ok, const char *what) {
+	if(!ok) {
+		printf("FAIL: %s\n", what);
+		gFailures++;
+	}
+}
+
+/**
+ * Runs a transaction: sends the command bytes, then clocks out rxLen bytes
+ * into rx (if specified.)
+ */
+static void check_txn(const uint8_t *cmd, size_t cmdLen, uint8_t *rx, size_t rxLen) {
+	flashsim_select(true);
+
+	for(size_t i = 0; i < cmdLen; i++) {
+		flashsim_exchange(cmd[i], CHECK_SCK);
+	}
+
+	for(size_t i = 0; i < rxLen; i++) {
+		uint8_t byte = flashsim_exchange(0x00, CHECK_SCK);
+
+		if(rx != NULL) {
+			rx[i] = byte;
+		}
+	}
+
+	flashsim_select(false);
+}
+
+/**
+ * Sends a single byte command.
+ */
+static void check_command(uint8_t command) {
+	check_txn(&command, 1, NULL, 0);
+}
+
+/**
+ * Reads the first status register.
+ */
+static uint8_t check_status(void) {
+	uint8_t cmd[1] = {0x05};
+	uint8_t status;
+
+	check_txn(cmd, sizeof(cmd), &status, 1);
+	return status;
+}
+
+/**
+ * Sends a command that takes an address, followed by data.
+ */
+static void check_address_cmd(uint8_t command, uint32_t address, const uint8_t *data, size_t len) {
+	uint8_t cmd[4 + 256];
+
+	cmd[0] = command;
+	cmd[1] = (uint8_t) (address >> 16);
+	cmd[2] = (uint8_t) (address >> 8);
+	cmd[3] = (uint8_t) address;
+
+	if(len != 0) {
+		memcpy(cmd + 4, data, len);
+	}
+
+	check_txn(cmd, 4 + len, NULL, 0);
+}
+
+/**
+ * Reads using the given read command (0x0B or 0x48), which take a dummy byte.
+ */
+static void check_read(uint8_t command, uint32_t address, uint8_t *buf, size_t len) {
+	uint8_t cmd[5] = {command, (uint8_t) (address >> 16), (uint8_t) (address >> 8), (uint8_t) address, 0x00};
+	check_txn(cmd, sizeof(cmd), buf, len);
+}
+
+/**
+ * Lets virtual time pass until the flash is idle.
+ */
+static void check_wait_idle(void) {
+	flashsim_advance(flashsim_idle_time() - flashsim_now());
+}
+
+
+
+/**
+ * Checks the JEDEC ID, and that bus time is charged per byte.
+ */
+static void check_id(void) {
+	uint8_t cmd[1] = {0x9F};
+	uint8_t id[3];
+
+	uint64_t start = flashsim_now();
+	check_txn(cmd, sizeof(cmd), id, sizeof(id));
+
+	check(id[0] == 0x1F && id[1] == 0x84 && id[2] == 0x01, "JEDEC ID is 1F 84 01");
+	check((flashsim_now() - start) == (4 * CHECK_BYTE_NS), "each byte takes eight bit times");
+	check(flashsim_stats()->busBytes == 4, "bus bytes are counted");
+	check(flashsim_stats()->csAssertions == 1, "/CS assertions are counted");
+}
+
+/**
+ * Checks that program commands need the write enable latch.
+ */
+static void check_write_enable(void) {
+	uint8_t data[4] = {0x12, 0x34, 0x56, 0x78};
+
+	check_address_cmd(0x02, CHECK_ADDRESS, data, sizeof(data));
+
+	check(flashsim_stats()->errWriteNotEnabled == 1, "program without WREN is counted");
+	check(flashsim_array()[CHECK_ADDRESS] == 0xFF, "program without WREN is ignored");
+	check(!(check_status() & 0x01), "program without WREN doesn't make the flash busy");
+
+	check_command(0x06);
+	check(check_status() == 0x02, "WREN sets WEL");
+
+	check_command(0x04);
+	check(check_status() == 0x00, "WRDI clears WEL");
+}
+
+/**
+ * Checks programming a page: data, busy time, and the state afterwards.
+ */
+static void check_program(void) {
+	uint8_t data[256], buf[256];
+
+	for(size_t i = 0; i < sizeof(data); i++) {
+		data[i] = (uint8_t) (i * 7);
+	}
+
+	check_command(0x06);
+	check_address_cmd(0x02, CHECK_ADDRESS & ~0xFF, data, sizeof(data));
+
+	check(flashsim_stats()->programCommands == 1, "page program is counted");
+	check(check_status() == 0x03, "flash is busy with WEL set while programming");
+
+	// commands other than status reads are violations while busy
+	check_read(0x0B, CHECK_ADDRESS, buf, 1);
+	check(flashsim_stats()->errCommandWhileBusy == 1, "read while busy is counted");
+
+	uint64_t busy = flashsim_idle_time() - flashsim_now();
+	check(busy > 300000 && busy <= 400000, "page program takes about 400us");
+
+	check_wait_idle();
+	check(check_status() == 0x00, "WIP and WEL clear once programming completes");
+
+	check_read(0x0B, CHECK_ADDRESS & ~0xFF, buf, sizeof(buf));
+	check(!memcmp(buf, data, sizeof(data)), "programmed data reads back");
+	check(!memcmp(flashsim_array() + (CHECK_ADDRESS & ~0xFF), data, sizeof(data)), "programmed data is in the array");
+	check(flashsim_stats()->errProgramNotErased == 0, "programming erased bytes is not a violation");
+
+	// setting bits that were already cleared is a violation (and has no effect)
+	uint8_t ones[1] = {0xFF};
+
+	check_command(0x06);
+	check_address_cmd(0x02, (CHECK_ADDRESS & ~0xFF) + 1, ones, sizeof(ones));
+	check_wait_idle();
+
+	check(flashsim_stats()->errProgramNotErased == (uint32_t) (8 - __builtin_popcount(data[1])),
+			"each bit programmed from 0 to 1 is counted");
+	check(flashsim_array()[(CHECK_ADDRESS & ~0xFF) + 1] == data[1], "programming can only clear bits");
+
+	// data past the end of the page wraps around to its start
+	uint8_t two[2] = {0x00, 0x00};
+
+	check_command(0x06);
+	check_address_cmd(0x02, CHECK_ADDRESS | 0xFF, two, sizeof(two));
+	check_wait_idle();
+
+	check(flashsim_stats()->errPageWrap == 1, "page wrap is counted");
+	check(flashsim_array()[CHECK_ADDRESS & ~0xFF] == 0x00, "page wrap programs the start of the page");
+	check(flashsim_array()[(CHECK_ADDRESS & ~0xFF) + 0x100] == 0xFF, "page wrap doesn't program the next page");
+}
+
+/**
+ * Checks erasing a 4K sector: only that sector is erased, and it takes the
+ * datasheet time.
+ */
+static void check_erase(void) {
+	uint32_t sector = CHECK_ADDRESS & ~0xFFF;
+
+	flashsim_array()[sector - 1] = 0x00;
+	flashsim_array()[sector + 0x1000] = 0x00;
+
+	// WREN is needed
+	check_address_cmd(0x20, CHECK_ADDRESS, NULL, 0);
+	check(flashsim_stats()->errWriteNotEnabled == 1, "erase without WREN is counted");
+
+	check_command(0x06);
+	check_address_cmd(0x20, CHECK_ADDRESS, NULL, 0);
+
+	check(flashsim_stats()->eraseCommands == 1, "erase is counted");
+
+	uint64_t busy = flashsim_idle_time() - flashsim_now();
+	check(busy >= 45000000 && busy <= 60000000, "4K erase takes about 60ms");
+
+	check_wait_idle();
+
+	bool blank = true;
+
+	for(uint32_t i = 0; i < 0x1000; i++) {
+		blank = blank && (flashsim_array()[sector + i] == 0xFF);
+	}
+
+	check(blank, "4K erase erases the sector");
+	check(flashsim_array()[sector - 1] == 0x00 && flashsim_array()[sector + 0x1000] == 0x00,
+			"4K erase leaves the neighbouring sectors alone");
+}
+
+/**
+ * Checks the security registers: addressing by bits 13-12, program, read and
+ * erase.
+ */
+static void check_security(void) {
+	uint8_t data[4] = {0xA5, 0x5A, 0x00, 0x0F}, buf[4];
+
+	check_command(0x06);
+	check_address_cmd(0x42, 0x2010, data, sizeof(data));
+	check_wait_idle();
+
+	check(!memcmp(flashsim_security(2) + 0x10, data, sizeof(data)), "security register 2 is at 0x2000");
+	check(flashsim_security(1)[0x10] == 0xFF, "other security registers are untouched");
+
+	check_read(0x48, 0x2010, buf, sizeof(buf));
+	check(!memcmp(buf, data, sizeof(data)), "security register data reads back");
+
+	check_command(0x06);
+	check_address_cmd(0x44, 0x2000, NULL, 0);
+	check_wait_idle();
+
+	check(flashsim_security(2)[0x10] == 0xFF, "security register erase erases it");
+
+	check_address_cmd(0x44, 0x0000, NULL, 0);
+	check(flashsim_stats()->errBadCommand == 1, "register 0 is not a security register");
+}
+
+/**
+ * Checks that data clocked out above the maximum clock is corrupted.
+ */
+static void check_max_clock(void) {
+	uint8_t buf[1];
+
+	flashsim_array()[0] = 0x42;
+
+	flashsim_set_max_clock(CHECK_SCK / 2);
+	check_read(0x0B, 0, buf, sizeof(buf));
+	check(buf[0] != 0x42, "reads above the maximum clock are corrupted");
+
+	flashsim_set_max_clock(CHECK_SCK);
+	check_read(0x0B, 0, buf, sizeof(buf));
+	check(buf[0] == 0x42, "reads at the maximum clock are correct");
+}
+
+
+
+int main(void) {
+	static void (*const kChecks[])(void) = {
+		check_id, check_write_enable, check_program, check_erase, check_security, check_max_clock
+	};
+
+	for(size_t i = 0; i < (sizeof(kChecks) / sizeof(kChecks[0])); i++) {
+		flashsim_reset();
+		kChecks[i]();
+	}
+
+	if(gFailures != 0) {
+		printf("%d checks failed\n", gFailures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,435 @@
+/*
+ * flashsim.c
+ *
+ * Behavioural model of the AT25SF041. Commands are decoded byte by byte while
+ * /CS is asserted; program and erase operations are executed when /CS is
+ * de-asserted, as on the real chip, and keep the flash busy for the typical
+ * datasheet time of that operation.
+ */
+#include "flashsim.h"
+
+#include <string.h>
+
+/// typical operation times, in nanoseconds
+#define TIME_PAGE_PROGRAM			400000ULL
+#define TIME_ERASE_4K				60000000ULL
+#define TIME_ERASE_32K				250000000ULL
+#define TIME_ERASE_64K				400000000ULL
+#define TIME_ERASE_SECURITY			60000000ULL
+
+/// JEDEC ID reported by the flash
+static const uint8_t kJedecId[3] = {0x1F, 0x84, 0x01};
+
+/// flash contents
+static uint8_t gArray[FLASHSIM_SIZE];
+/// security registers
+static uint8_t gSecurity[FLASHSIM_NUM_SECURITY][FLASHSIM_SECURITY_SIZE];
+
+/// counters
+static flashsim_stats_t gStats;
+
+/// virtual time, in nanoseconds
+static uint64_t gNow = 0;
+/// maximum SPI clock at which data is output correctly
+static uint32_t gMaxClock = 104000000;
+
+/// whether /CS is asserted
+static bool gSelected = false;
+/// the flash is busy with an internal operation until this time
+static uint64_t gBusyUntil = 0;
+/// write enable latch
+static bool gWriteEnabled = false;
+
+/// state of the current transaction
+static struct {
+	/// number of bytes received so far
+	size_t pos;
+	/// command byte
+	uint8_t command;
+	/// address, once received
+	uint32_t address;
+	/// whether the flash was busy when the transaction started
+	bool busy;
+
+	/// page buffer for program commands
+	uint8_t page[256];
+	/// number of data bytes received for a program command
+	size_t dataLen;
+} gTxn;
+
+
+
+/**
+ * Resets the model: the array and security registers are erased, the clock is
+ * set back to zero and all counters are cleared.
+ */
+void flashsim_reset(void) {
+	memset(gArray, 0xFF, sizeof(gArray));
+	memset(gSecurity, 0xFF, sizeof(gSecurity));
+
+	gNow = 0;
+	gBusyUntil = 0;
+	gWriteEnabled = false;
+	gSelected = false;
+	gMaxClock = 104000000;
+
+	flashsim_clear_stats();
+}
+
+/**
+ * Returns the counters kept by the model.
+ */
+flashsim_stats_t *flashsim_stats(void) {
+	return &gStats;
+}
+
+/**
+ * Clears the counters kept by the model.
+ */
+void flashsim_clear_stats(void) {
+	memset(&gStats, 0, sizeof(gStats));
+}
+
+/**
+ * Returns a pointer to the flash array, for preloading or inspecting data.
+ */
+uint8_t *flashsim_array(void) {
+	return gArray;
+}
+
+/**
+ * Returns a pointer to a security register (1-3).
+ */
+uint8_t *flashsim_security(int reg) {
+	if(reg < 1 || reg > FLASHSIM_NUM_SECURITY) {
+		return NULL;
+	}
+
+	return gSecurity[reg - 1];
+}
+
+/**
+ * Sets the maximum SPI clock at which the flash responds correctly. Data read
+ * above this clock is corrupted.
+ */
+void flashsim_set_max_clock(uint32_t hz) {
+	gMaxClock = hz;
+}
+
+
+
+/**
+ * Returns the current virtual time, in nanoseconds.
+ */
+uint64_t flashsim_now(void) {
+	return gNow;
+}
+
+/**
+ * Advances the virtual clock by the given number of nanoseconds.
+ */
+void flashsim_advance(uint64_t ns) {
+	gNow += ns;
+}
+
+/**
+ * Returns the virtual time at which the flash completes its current internal
+ * operation, or the current time if it's idle.
+ */
+uint64_t flashsim_idle_time(void) {
+	return (gBusyUntil > gNow) ? gBusyUntil : gNow;
+}
+
+
+
+/**
+ * Whether the flash is currently busy with an internal operation.
+ */
+static bool flashsim_busy(void) {
+	return (gNow < gBusyUntil);
+}
+
+/**
+ * Updates state once an internal operation has completed: this clears the
+ * write enable latch.
+ */
+static void flashsim_settle(void) {
+	if(gBusyUntil != 0 && !flashsim_busy()) {
+		gWriteEnabled = false;
+		gBusyUntil = 0;
+	}
+}
+
+/**
+ * Returns the first status register byte: WIP in bit 0, WEL in bit 1.
+ */
+static uint8_t flashsim_status1(void) {
+	flashsim_settle();
+
+	return (flashsim_busy() ? 0x01 : 0x00) | (gWriteEnabled ? 0x02 : 0x00);
+}
+
+/**
+ * Starts an internal operation that takes the given time.
+ */
+static void flashsim_start_op(uint64_t duration) {
+	gBusyUntil = gNow + duration;
+}
+
+/**
+ * Resolves a security register address (register number in bits 13-12) to the
+ * start of that register, or NULL if the address doesn't name a register.
+ */
+static uint8_t *flashsim_security_reg(uint32_t address) {
+	return flashsim_security((address >> 12) & 0x3);
+}
+
+/**
+ * Programs the received page buffer into memory.
+ */
+static void flashsim_program(uint8_t *base, size_t size, uint32_t address) {
+	uint32_t pageStart = address & ~0xFFU;
+	size_t count = (gTxn.dataLen > 256) ? 256 : gTxn.dataLen;
+
+	if(((address & 0xFF) + gTxn.dataLen) > 256) {
+		gStats.errPageWrap++;
+	}
+
+	for(size_t i = 0; i < count; i++) {
+		uint32_t offset = (address + i) & 0xFF;
+		uint32_t target = (pageStart + offset) % size;
+
+		uint8_t data = gTxn.page[offset];
+
+		// programming can only clear bits
+		uint8_t setBits = (uint8_t) (data & ~base[target]);
+
+		while(setBits) {
+			gStats.errProgramNotErased += (setBits & 1);
+			setBits >>= 1;
+		}
+
+		base[target] &= data;
+	}
+}
+
+/**
+ * Executes the command of the current transaction, when /CS is de-asserted.
+ */
+static void flashsim_execute(void) {
+	// only status reads are accepted while busy
+	if(gTxn.busy) {
+		if(gTxn.command != 0x05 && gTxn.command != 0x35) {
+			gStats.errCommandWhileBusy++;
+		}
+		return;
+	}
+
+	switch(gTxn.command) {
+		// write enable/disable
+		case 0x06:
+		case 0x04:
+			if(gTxn.pos != 1) {
+				gStats.errBadCommand++;
+				break;
+			}
+
+			gWriteEnabled = (gTxn.command == 0x06);
+			break;
+
+		// page program
+		case 0x02:
+		case 0x42:
+			if(gTxn.pos < 5) {
+				gStats.errBadCommand++;
+				break;
+			} else if(!gWriteEnabled) {
+				gStats.errWriteNotEnabled++;
+				break;
+			}
+
+			if(gTxn.command == 0x02) {
+				flashsim_program(gArray, sizeof(gArray), gTxn.address);
+			} else {
+				uint8_t *reg = flashsim_security_reg(gTxn.address);
+
+				if(reg == NULL) {
+					gStats.errBadCommand++;
+					break;
+				}
+
+				flashsim_program(reg, FLASHSIM_SECURITY_SIZE, gTxn.address);
+			}
+
+			gStats.programCommands++;
+			flashsim_start_op(TIME_PAGE_PROGRAM);
+			break;
+
+		// block erase
+		case 0x20:
+		case 0x52:
+		case 0xD8: {
+			if(gTxn.pos != 4) {
+				gStats.errBadCommand++;
+				break;
+			} else if(!gWriteEnabled) {
+				gStats.errWriteNotEnabled++;
+				break;
+			}
+
+			uint32_t size = 0x1000;
+			uint64_t duration = TIME_ERASE_4K;
+
+			if(gTxn.command == 0x52) {
+				size = 0x8000;
+				duration = TIME_ERASE_32K;
+			} else if(gTxn.command == 0xD8) {
+				size = 0x10000;
+				duration = TIME_ERASE_64K;
+			}
+
+			uint32_t start = (gTxn.address & ~(size - 1)) % FLASHSIM_SIZE;
+			memset(gArray + start, 0xFF, size);
+
+			gStats.eraseCommands++;
+			flashsim_start_op(duration);
+			break;
+		}
+
+		// security register erase
+		case 0x44: {
+			uint8_t *reg = flashsim_security_reg(gTxn.address);
+
+			if(gTxn.pos != 4 || reg == NULL) {
+				gStats.errBadCommand++;
+				break;
+			} else if(!gWriteEnabled) {
+				gStats.errWriteNotEnabled++;
+				break;
+			}
+
+			memset(reg, 0xFF, FLASHSIM_SECURITY_SIZE);
+
+			gStats.eraseCommands++;
+			flashsim_start_op(TIME_ERASE_SECURITY);
+			break;
+		}
+
+		// commands that don't do anything on /CS de-assertion
+		case 0x05:
+		case 0x35:
+		case 0x9F:
+		case 0x0B:
+		case 0x48:
+			break;
+
+		default:
+			gStats.errBadCommand++;
+			break;
+	}
+}
+
+/**
+ * Changes the state of the /CS line.
+ */
+void flashsim_select(bool selected) {
+	if(selected == gSelected) {
+		return;
+	}
+
+	gSelected = selected;
+
+	if(selected) {
+		gStats.csAssertions++;
+		flashsim_settle();
+
+		memset(&gTxn, 0, sizeof(gTxn));
+		memset(gTxn.page, 0xFF, sizeof(gTxn.page));
+
+		gTxn.busy = flashsim_busy();
+	} else if(gTxn.pos != 0) {
+		flashsim_execute();
+	}
+}
+
+/**
+ * Clocks a byte into the flash at the given SPI clock, and returns the byte it
+ * clocked out. This advances the virtual clock by eight bit times.
+ */
+uint8_t flashsim_exchange(uint8_t mosi, uint32_t sckHz) {
+	uint8_t miso = 0xFF;
+
+	gNow += (8ULL * 1000000000ULL) / sckHz;
+	gStats.busBytes++;
+
+	if(!gSelected) {
+		return miso;
+	}
+
+	size_t pos = gTxn.pos++;
+
+	// first byte is the command
+	if(pos == 0) {
+		gTxn.command = mosi;
+
+		if(mosi == 0x0B || mosi == 0x48) {
+			gStats.readCommands++;
+		}
+
+		return miso;
+	}
+
+	// bytes 1-3 are the address, for commands that take one
+	if(pos <= 3) {
+		gTxn.address = (gTxn.address << 8) | mosi;
+	}
+
+	switch(gTxn.command) {
+		case 0x05:
+			gStats.statusPolls++;
+			miso = flashsim_status1();
+			break;
+
+		case 0x35:
+			gStats.statusPolls++;
+			miso = 0x00;
+			break;
+
+		case 0x9F:
+			miso = (pos <= 3) ? kJedecId[pos - 1] : 0x00;
+			break;
+
+		case 0x0B:
+			// 3 address bytes and a dummy byte precede the data
+			if(pos >= 5 && !gTxn.busy) {
+				miso = gArray[(gTxn.address + (pos - 5)) % FLASHSIM_SIZE];
+			}
+			break;
+
+		case 0x48:
+			if(pos >= 5 && !gTxn.busy) {
+				uint8_t *reg = flashsim_security_reg(gTxn.address);
+
+				if(reg != NULL) {
+					miso = reg[(gTxn.address + (pos - 5)) & 0xFF];
+				}
+			}
+			break;
+
+		case 0x02:
+		case 0x42:
+			// data wraps around within the page
+			if(pos >= 4) {
+				gTxn.page[(gTxn.address + gTxn.dataLen) & 0xFF] = mosi;
+				gTxn.dataLen++;
+			}
+			break;
+	}
+
+	// data clocked out faster than the flash supports is garbage
+	if(sckHz > gMaxClock) {
+		miso ^= (uint8_t) (gNow & 0xFF) | 0x01;
+	}
+
+	return miso;
+}
@@ -0,0 +1,128 @@
+/*
+ * flashsim.h
+ *
+ * Host-side behavioural model of the AT25SF041 SPI flash. Together with
+ * spi_sim.c, which provides the interfaces in spi.h and systick.h on top of
+ * this model, it allows the flash driver (src/drivers/spi_flash.c) to run
+ * off-target, e.g.:
+ *
+ *   cc -I../../src/drivers -o program program.c flashsim.c spi_sim.c \
+ *     ../../src/drivers/spi_flash.c
+ *
+ * All time is virtual: SPI traffic charges bus cycles at the configured clock,
+ * and internal operations (program/erase) keep the flash busy for their
+ * typical datasheet times.
+ */
+
+#ifndef FLASHSIM_H_
+#define FLASHSIM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// size of the flash array
+#define FLASHSIM_SIZE				0x80000
+/// size of a single security register
+#define FLASHSIM_SECURITY_SIZE		0x100
+/// number of security registers (registers 1-3 are addressed by bits 13-12)
+#define FLASHSIM_NUM_SECURITY		3
+
+/// APB clock the SPI clock is derived from
+#define FLASHSIM_PCLK				48000000
+
+/**
+ * Counters kept by the model. These can be reset at any time.
+ */
+typedef struct {
+	/// total bytes clocked over the bus
+	uint32_t busBytes;
+	/// number of times /CS was asserted
+	uint32_t csAssertions;
+	/// status register bytes clocked out (0x05/0x35)
+	uint32_t statusPolls;
+	/// read commands (0x0B, 0x48)
+	uint32_t readCommands;
+	/// page program commands executed (0x02, 0x42)
+	uint32_t programCommands;
+	/// erase commands executed (0x20, 0x52, 0xD8, 0x44)
+	uint32_t eraseCommands;
+
+	/// program/erase commands ignored because the write enable latch was clear
+	uint32_t errWriteNotEnabled;
+	/// commands other than status reads sent while the flash was busy
+	uint32_t errCommandWhileBusy;
+	/// bits that a program command attempted to change from 0 to 1
+	uint32_t errProgramNotErased;
+	/// page programs whose data wrapped around to the start of the page
+	uint32_t errPageWrap;
+	/// malformed or unknown commands
+	uint32_t errBadCommand;
+} flashsim_stats_t;
+
+
+
+/**
+ * Resets the model: the array and security registers are erased, the clock is
+ * set back to zero and all counters are cleared.
+ */
+void flashsim_reset(void);
+
+/**
+ * Returns the counters kept by the model.
+ */
+flashsim_stats_t *flashsim_stats(void);
+
+/**
+ * Clears the counters kept by the model.
+ */
+void flashsim_clear_stats(void);
+
+/**
+ * Returns a pointer to the flash array, for preloading or inspecting data.
+ */
+uint8_t *flashsim_array(void);
+
+/**
+ * Returns a pointer to a security register (1-3).
+ */
+uint8_t *flashsim_security(int reg);
+
+/**
+ * Sets the maximum SPI clock at which the flash responds correctly. Data read
+ * above this clock is corrupted.
+ */
+void flashsim_set_max_clock(uint32_t hz);
+
+
+
+/**
+ * Returns the current virtual time, in nanoseconds.
+ */
+uint64_t flashsim_now(void);
+
+/**
+ * Advances the virtual clock by the given number of nanoseconds.
+ */
+void flashsim_advance(uint64_t ns);
+
+/**
+ * Returns the virtual time at which the flash completes its current internal
+ * operation, or the current time if it's idle.
+ */
+uint64_t flashsim_idle_time(void);
+
+
+
+/**
+ * Changes the state of the /CS line.
+ */
+void flashsim_select(bool selected);
+
+/**
+ * Clocks a byte into the flash at the given SPI clock, and returns the byte it
+ * clocked out. This advances the virtual clock by eight bit times.
+ */
+uint8_t flashsim_exchange(uint8_t mosi, uint32_t sckHz);
+
+#endif /* FLASHSIM_H_ */
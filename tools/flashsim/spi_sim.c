@@ -0,0 +1,176 @@
+/*
+ * spi_sim.c
+ *
+ * Implements the SPI driver (spi.h) and SysTick time base (systick.h) on top
+ * of the flash model, so the flash driver can run on the host unmodified.
+ *
+ * Each transfer routine charges the bus time of the bytes it clocks, plus the
+ * CPU overhead it would have on the target: spi_io() leaves a gap between
+ * bytes, while bursts and DMA transfers keep the bus busy back to back.
+ */
+#include "spi.h"
+#include "systick.h"
+
+#include "flashsim.h"
+#include "errors.h"
+
+/// idle time between bytes sent with spi_io() (about 20 cycles at 48MHz)
+#define SIM_SPI_IO_GAP_NS			420
+/// setup time of a DMA transfer (about 60 cycles at 48MHz)
+#define SIM_DMA_SETUP_NS			1250
+/// time taken by one iteration of a polling loop (about 12 cycles at 48MHz)
+#define SIM_POLL_LOOP_NS			250
+
+/// currently selected prescaler
+static spi_prescaler_t gPrescaler = kSpiPrescalerDefault;
+
+/// virtual time at which the SysTick timer next expires
+static uint64_t gNextTick = 0;
+/// whether the SysTick timer is running
+static bool gTickRunning = false;
+
+/**
+ * Returns the SPI clock for the current prescaler.
+ */
+static uint32_t spi_sim_clock(void) {
+	return FLASHSIM_PCLK / (2U << gPrescaler);
+}
+
+
+
+/**
+ * Initializes the SPI peripheral.
+ */
+void spi_init(void) {
+	gPrescaler = kSpiPrescalerDefault;
+}
+
+/**
+ * Changes the SPI clock prescaler.
+ */
+void spi_set_prescaler(spi_prescaler_t prescaler) {
+	gPrescaler = prescaler;
+}
+
+/**
+ * Returns the currently selected SPI clock prescaler.
+ */
+spi_prescaler_t spi_get_prescaler(void) {
+	return gPrescaler;
+}
+
+/**
+ * Begins an SPI transaction.
+ */
+void spi_begin(void) {
+	flashsim_select(true);
+}
+
+/**
+ * Ends an SPI transaction.
+ */
+void spi_end(void) {
+	flashsim_select(false);
+}
+
+/**
+ * Writes a single byte to the SPI, then returns the byte read.
+ */
+uint8_t spi_io(uint8_t out) {
+	flashsim_advance(SIM_SPI_IO_GAP_NS);
+	return flashsim_exchange(out, spi_sim_clock());
+}
+
+/**
+ * Exchanges len bytes without gaps between bytes.
+ */
+int spi_burst(const void *_tx, void *_rx, size_t len) {
+	const uint8_t *tx = (const uint8_t *) _tx;
+	uint8_t *rx = (uint8_t *) _rx;
+
+	for(size_t i = 0; i < len; i++) {
+		uint8_t in = flashsim_exchange((tx != NULL) ? tx[i] : 0x00, spi_sim_clock());
+
+		if(rx != NULL) {
+			rx[i] = in;
+		}
+	}
+
+	return kErrSuccess;
+}
+
+/**
+ * Performs a DMA transfer. The transfer completes immediately in the model;
+ * the virtual clock is advanced by the time it would have taken.
+ */
+int spi_transfer(const void *tx, void *rx, size_t len) {
+	if(len > 0xFFFF) {
+		return kErrInvalidArgs;
+	} else if(len == 0) {
+		return kErrSuccess;
+	}
+
+	flashsim_advance(SIM_DMA_SETUP_NS);
+	return spi_burst(tx, rx, len);
+}
+
+/**
+ * Performs a DMA transfer that receives len bytes into buf.
+ */
+int spi_receive(void *buf, size_t len) {
+	if(buf == NULL) {
+		return kErrInvalidArgs;
+	}
+
+	return spi_transfer(NULL, buf, len);
+}
+
+/**
+ * DMA transfers complete immediately in the model.
+ */
+bool spi_transfer_done(void) {
+	return true;
+}
+
+/**
+ * DMA transfers complete immediately in the model.
+ */
+void spi_wait(void) {
+
+}
+
+
+
+/**
+ * Starts the SysTick timer with a period of 1 ms.
+ */
+void systick_start(void) {
+	gNextTick = flashsim_now() + 1000000;
+	gTickRunning = true;
+}
+
+/**
+ * Stops the SysTick timer.
+ */
+void systick_stop(void) {
+	gTickRunning = false;
+}
+
+/**
+ * Returns true if a millisecond has elapsed since the last call. Each call is
+ * charged as one iteration of a polling loop.
+ */
+bool systick_elapsed(void) {
+	flashsim_advance(SIM_POLL_LOOP_NS);
+
+	if(!gTickRunning || flashsim_now() < gNextTick) {
+		return false;
+	}
+
+	// like COUNTFLAG, multiple expired periods are reported only once
+	while(gNextTick <= flashsim_now()) {
+		gNextTick += 1000000;
+	}
+
+	return true;
+}
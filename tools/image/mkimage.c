@@ -0,0 +1,83 @@
+/*
+ * mkimage.c
+ *
+ * Adds an image header to a firmware image, so it can be stored in a firmware
+ * slot as is. Build with:
+ *
+ *   cc -I../../include -I../../src -o mkimage mkimage.c ../../src/crc32.c
+ *
+ * and run as:
+ *
+ *   mkimage in.bin version out.bin
+ *
+ * where version is the firmware version of the image, in hex. Trailing 0xFF
+ * bytes are left out of the image.
+ */
+#include "bootloader.h"
+#include "crc32.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// image to write
+static uint8_t gImage[BOOTLOADER_APP_SIZE];
+
+
+
+int main(int argc, char **argv) {
+	if(argc != 4) {
+		fprintf(stderr, "usage: %s in.bin version out.bin\n", argv[0]);
+		return 1;
+	}
+
+	// read the image
+	FILE *fp = fopen(argv[1], "rb");
+
+	if(fp == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	size_t len = fread(gImage, 1, sizeof(gImage), fp);
+
+	if(!feof(fp) && fgetc(fp) != EOF) {
+		fprintf(stderr, "%s: larger than %u bytes\n", argv[1], BOOTLOADER_APP_SIZE);
+		return 1;
+	}
+
+	fclose(fp);
+
+	// trailing 0xFF bytes are not part of the image
+	while(len != 0 && gImage[len - 1] == 0xFF) {
+		len--;
+	}
+
+	// write it out, with the image header
+	bootloader_image_header_t header = {
+		.magic = BOOTLOADER_IMAGE_MAGIC,
+		.headerVersion = BOOTLOADER_IMAGE_HEADER_VERSION,
+		.type = BOOTLOADER_IMAGE_TYPE_RAW,
+		.flags = 0,
+
+		.length = (uint32_t) len,
+		.crc32 = crc32_update(0, gImage, len),
+
+		.version = (uint16_t) strtoul(argv[2], NULL, 16),
+		.reserved = 0xFFFF
+	};
+
+	fp = fopen(argv[3], "wb");
+
+	if(fp == NULL) {
+		perror(argv[3]);
+		return 1;
+	}
+
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(gImage, 1, len, fp);
+	fclose(fp);
+
+	printf("%zu byte image\n", len);
+	return 0;
+}
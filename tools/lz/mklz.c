@@ -0,0 +1,224 @@
+/*
+ * mklz.c
+ *
+ * Compresses a firmware image, and writes it (including the image header) so
+ * it can be stored in a firmware slot as is. Build with:
+ *
+ *   cc -I../../include -I../../src -o mklz mklz.c ../../src/crc32.c
+ *
+ * and run as:
+ *
+ *   mklz in.bin version out.bin
+ *
+ * where version is the firmware version of the image, in hex.
+ *
+ * The compressed data is decompressed again before it's written, to check that
+ * it produces the original image.
+ */
+#include "bootloader.h"
+#include "crc32.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// image to compress
+static uint8_t gImage[BOOTLOADER_APP_SIZE];
+static size_t gImageLen;
+
+/// compressed data (at most 9 bytes for every 8 input bytes, plus the header)
+static uint8_t gOut[BOOTLOADER_APP_SIZE * 2];
+static size_t gOutLen = 0;
+
+
+
+/**
+ * Reads the image from a file, and returns its length without trailing 0xFF
+ * bytes, or 0 on error.
+ */
+static size_t lz_read_file(const char *path, uint8_t *buf) {
+	FILE *fp = fopen(path, "rb");
+
+	if(fp == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	size_t len = fread(buf, 1, BOOTLOADER_APP_SIZE, fp);
+
+	if(!feof(fp) && fgetc(fp) != EOF) {
+		fprintf(stderr, "%s: larger than %u bytes\n", path, BOOTLOADER_APP_SIZE);
+		len = 0;
+	}
+
+	fclose(fp);
+
+	// trailing 0xFF bytes are not part of the image
+	while(len != 0 && buf[len - 1] == 0xFF) {
+		len--;
+	}
+
+	return len;
+}
+
+/**
+ * Finds the longest match for the data at the given offset in the window
+ * before it. Returns its length, and writes its distance to *distance.
+ */
+static size_t lz_find_match(size_t offset, size_t *distance) {
+	size_t bestLen = 0;
+	size_t max = gImageLen - offset;
+
+	if(max > BOOTLOADER_LZ_MAX_MATCH) {
+		max = BOOTLOADER_LZ_MAX_MATCH;
+	}
+
+	for(size_t d = 1; d <= BOOTLOADER_LZ_WINDOW && d <= offset; d++) {
+		size_t len = 0;
+
+		// matches may overlap the data being encoded
+		while(len < max && gImage[offset - d + len] == gImage[offset + len]) {
+			len++;
+		}
+
+		if(len > bestLen) {
+			bestLen = len;
+			*distance = d;
+
+			if(len == max) {
+				break;
+			}
+		}
+	}
+
+	return bestLen;
+}
+
+/**
+ * Compresses the image into the output buffer, after the header.
+ */
+static void lz_compress(void) {
+	size_t flagPos = 0;
+	int item = 8;
+
+	for(size_t offset = 0; offset < gImageLen;) {
+		// start a new group
+		if(item == 8) {
+			flagPos = gOutLen++;
+			gOut[flagPos] = 0;
+			item = 0;
+		}
+
+		size_t distance = 0;
+		size_t len = lz_find_match(offset, &distance);
+
+		if(len >= BOOTLOADER_LZ_MIN_MATCH) {
+			uint16_t ref = (uint16_t) (((len - BOOTLOADER_LZ_MIN_MATCH) << 12) | (distance - 1));
+
+			gOut[gOutLen++] = (uint8_t) ref;
+			gOut[gOutLen++] = (uint8_t) (ref >> 8);
+
+			offset += len;
+		} else {
+			gOut[flagPos] |= (uint8_t) (1 << item);
+			gOut[gOutLen++] = gImage[offset++];
+		}
+
+		item++;
+	}
+}
+
+/**
+ * Decompresses the output the way the loader does, and checks that the result
+ * is the original image. Returns 0 if so.
+ */
+static int lz_verify(void) {
+	static uint8_t out[BOOTLOADER_APP_SIZE];
+	size_t pos = sizeof(bootloader_lz_header_t);
+	size_t offset = 0;
+	unsigned int flags = 0;
+
+	while(offset < gImageLen) {
+		if((flags & 0xFF00) == 0) {
+			flags = gOut[pos++] | 0xFF00;
+		}
+
+		if(flags & 1) {
+			out[offset++] = gOut[pos++];
+		} else {
+			size_t distance = (((gOut[pos + 1] & 0x0F) << 8) | gOut[pos]) + 1;
+			size_t len = (gOut[pos + 1] >> 4) + BOOTLOADER_LZ_MIN_MATCH;
+			pos += 2;
+
+			if(distance > offset || len > (gImageLen - offset)) {
+				return -1;
+			}
+
+			for(; len != 0; len--, offset++) {
+				out[offset] = out[offset - distance];
+			}
+		}
+
+		flags >>= 1;
+	}
+
+	return (pos == gOutLen && !memcmp(out, gImage, gImageLen)) ? 0 : -1;
+}
+
+
+
+int main(int argc, char **argv) {
+	if(argc != 4) {
+		fprintf(stderr, "usage: %s in.bin version out.bin\n", argv[0]);
+		return 1;
+	}
+
+	gImageLen = lz_read_file(argv[1], gImage);
+
+	if(gImageLen == 0) {
+		return 1;
+	}
+
+	// compress it
+	bootloader_lz_header_t lz = {
+		.length = (uint32_t) gImageLen
+	};
+
+	memcpy(gOut, &lz, sizeof(lz));
+	gOutLen = sizeof(lz);
+
+	lz_compress();
+
+	if(lz_verify() != 0) {
+		fprintf(stderr, "compressed data does not reproduce %s\n", argv[1]);
+		return 1;
+	}
+
+	// write it out, with the image header
+	bootloader_image_header_t header = {
+		.magic = BOOTLOADER_IMAGE_MAGIC,
+		.headerVersion = BOOTLOADER_IMAGE_HEADER_VERSION,
+		.type = BOOTLOADER_IMAGE_TYPE_LZ,
+		.flags = 0,
+
+		.length = (uint32_t) gOutLen,
+		.crc32 = crc32_update(0, gImage, gImageLen),
+
+		.version = (uint16_t) strtoul(argv[2], NULL, 16),
+		.reserved = 0xFFFF
+	};
+
+	FILE *fp = fopen(argv[3], "wb");
+
+	if(fp == NULL) {
+		perror(argv[3]);
+		return 1;
+	}
+
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(gOut, 1, gOutLen, fp);
+	fclose(fp);
+
+	printf("%zu byte image -> %zu bytes compressed\n", gImageLen, gOutLen);
+	return 0;
+}